@@ -26,11 +26,10 @@ void setup() {
   HitecDSettings settings;
   settings.rangeLeftAPV = HitecDSettings::widestRangeLeftAPV(modelNumber);
   settings.rangeRightAPV = HitecDSettings::widestRangeRightAPV(modelNumber);
-  result = servo.writeSettings(settings);
+  /* writeSettings() reboots the servo. HITECD_WRITE_WAIT_UNTIL_READY makes it
+  wait until the servo has finished rebooting, which takes about 1000ms. */
+  result = servo.writeSettings(settings, HITECD_WRITE_WAIT_UNTIL_READY);
   if (result != HITECD_OK) { printError(result); }
-
-  /* After writeSettings(), we must wait 1000ms for the servo to reboot. */
-  delay(1000);
 }
 
 void loop() {
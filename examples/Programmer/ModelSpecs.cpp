@@ -54,12 +54,16 @@ void setupUnsupportedModelSpecs() {
     0xC4
   };
 
+  uint16_t values[sizeof(registersToDebug)];
+  int results[sizeof(registersToDebug)];
+  servo.readRawRegisters(registersToDebug, sizeof(registersToDebug), values,
+    results);
+
   for (int i = 0; i < (int)sizeof(registersToDebug); ++i) {
     uint8_t reg = registersToDebug[i];
-    uint16_t temp;
-    int res;
-    if ((res = servo.readRawRegister(reg, &temp)) != HITECD_OK) {
-      printErr(res, true);
+    uint16_t temp = values[i];
+    if (results[i] != HITECD_OK) {
+      printErr(results[i], true);
     }
     Serial.print((reg >> 4) & 0x0F, HEX);
     Serial.print((reg >> 0) & 0x0F, HEX);
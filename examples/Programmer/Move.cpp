@@ -1,8 +1,7 @@
 #include "Move.h"
 
-#include <HitecDServoInternal.h>
-
 #include "CommandLine.h"
+#include "ModelSpecs.h"
 #include "Programmer.h"
 
 void askAndMoveToMicros() {
@@ -29,39 +28,29 @@ cancel:
 }
 
 void moveToQuarterMicros(int16_t quarterMicros) {
-  int16_t startAPV = servo.readCurrentAPV();
-  if (startAPV < 0) {
-    printErr(startAPV, true);
-  }
-
   servo.writeTargetQuarterMicros(quarterMicros);
 
   long startMs = millis();
-  int16_t prevAPV = startAPV;
-  for (long nextMs = 100; nextMs < 10000; nextMs += 100) {
-    long currentMs = millis() - startMs;
-    delay(nextMs - currentMs);
-
-    int16_t nextAPV = servo.readCurrentAPV();
-    if (nextAPV < 0) {
-      printErr(nextAPV, true);
-    }
-
-    if (abs(prevAPV - nextAPV) < 10) {
-      Serial.print(F("Servo moved to APV="));
-      Serial.print(nextAPV);
-      Serial.print(F(" in about "));
-      Serial.print(nextMs / 1000);
-      Serial.print('.');
-      Serial.print((nextMs % 1000) / 100);
-      Serial.println(F("s."));
-      return;
-    }
-
-    prevAPV = nextAPV;
+  int res = servo.waitForMoveComplete(10000);
+  long elapsedMs = millis() - startMs;
+  if (res == HITECD_ERR_MOVE_TIMEOUT) {
+    Serial.println(F("Warning: Servo did not finish moving within 10s."));
+    return;
+  } else if (res != HITECD_OK) {
+    printErr(res, true);
   }
 
-  Serial.println(F("Warning: Servo did not finish moving within 10s."));
+  int16_t actualAPV = servo.readCurrentAPV();
+  if (actualAPV < 0) {
+    printErr(actualAPV, true);
+  }
+  Serial.print(F("Servo moved to APV="));
+  Serial.print(actualAPV);
+  Serial.print(F(" in about "));
+  Serial.print(elapsedMs / 1000);
+  Serial.print('.');
+  Serial.print((elapsedMs % 1000) / 100);
+  Serial.println(F("s."));
 }
 
 /* When moving gently to arbitrary APVs, temporarily overwrite the servo
@@ -72,10 +61,14 @@ itself. */
 #define GENTLE_MOVEMENT_RANGE_CENTER_APV (HITECD_APV_MAX / 2)
 #define GENTLE_MOVEMENT_RANGE_RIGHT_APV (HITECD_APV_MAX - 50)
 
+/* Gentle movements often end with the servo pushing against a physical limit
+short of its target, so only check the velocity to tell when it's done moving;
+but check a few times, because it starts slowly at such a low power limit. */
+#define GENTLE_MOVEMENT_SETTLED_READS 3
+
 bool usingGentleMovementSettings = false;
 
-uint16_t savedRangeLeftAPV, savedRangeRightAPV, savedRangeCenterAPV;
-uint16_t savedSpeed, savedPowerLimit;
+HitecDSettings settingsBeforeGentleMovement;
 
 void useGentleMovementSettings() {
   if (usingGentleMovementSettings) {
@@ -85,42 +78,26 @@ void useGentleMovementSettings() {
   Serial.println(F(
     "Temporarily changing servo settings to widest range & low power..."));
 
+  /* The range only takes effect after a reboot, so that part still gets saved;
+  but the speed and power limit are never saved. */
+  HitecDSettings gentleSettings = settings;
+  gentleSettings.rangeLeftAPV = GENTLE_MOVEMENT_RANGE_LEFT_APV;
+  gentleSettings.rangeRightAPV = GENTLE_MOVEMENT_RANGE_RIGHT_APV;
+  gentleSettings.rangeCenterAPV = GENTLE_MOVEMENT_RANGE_CENTER_APV;
+  gentleSettings.speed = 25;
+  gentleSettings.powerLimit = 20;
+
   int res;
-  if ((res = servo.readRawRegister(
-      HD_REG_RANGE_LEFT_APV, &savedRangeLeftAPV))!= HITECD_OK) {
-    printErr(res, true);
-  }
-  if ((res = servo.readRawRegister(
-      HD_REG_RANGE_RIGHT_APV, &savedRangeRightAPV)) != HITECD_OK) {
-    printErr(res, true);
-  }
-  if ((res = servo.readRawRegister(
-      HD_REG_RANGE_CENTER_APV, &savedRangeCenterAPV)) != HITECD_OK) {
-    printErr(res, true);
-  }
-  if ((res = servo.readRawRegister(
-      HD_REG_SPEED, &savedSpeed)) != HITECD_OK) {
-    printErr(res, true);
-  }
-  if ((res = servo.readRawRegister(
-      HD_REG_POWER_LIMIT, &savedPowerLimit)) != HITECD_OK) {
+  res = servo.applySettingsVolatileUnsupportedModelThisMightDamageTheServo(
+    gentleSettings,
+    allowUnsupportedModel,
+    &settingsBeforeGentleMovement);
+  if (res != HITECD_OK) {
     printErr(res, true);
   }
 
-  servo.writeRawRegister(
-    HD_REG_RANGE_LEFT_APV, GENTLE_MOVEMENT_RANGE_LEFT_APV);
-  servo.writeRawRegister(
-    HD_REG_RANGE_RIGHT_APV, GENTLE_MOVEMENT_RANGE_RIGHT_APV);
-  servo.writeRawRegister(
-    HD_REG_RANGE_CENTER_APV, GENTLE_MOVEMENT_RANGE_CENTER_APV);
-  servo.writeRawRegister(
-    HD_REG_SPEED, 5);
-  servo.writeRawRegister(
-    HD_REG_POWER_LIMIT, 400);
-
-  servo.writeRawRegister(HD_REG_SAVE, HD_SAVE_CONST);
-  servo.writeRawRegister(HD_REG_REBOOT, HD_REBOOT_CONST);
-  delay(1000);
+  servo.setMoveCompleteThresholds(
+    HITECD_MOVE_DEFAULT_MAX_VELOCITY, -1, GENTLE_MOVEMENT_SETTLED_READS);
 
   Serial.println(F("Done."));
   usingGentleMovementSettings = true;
@@ -133,27 +110,20 @@ void undoGentleMovementSettings() {
 
   Serial.println(F("Undoing temporary changes to servo settings..."));
 
-  servo.writeRawRegister(
-    HD_REG_RANGE_LEFT_APV, savedRangeLeftAPV);
-  servo.writeRawRegister(
-    HD_REG_RANGE_RIGHT_APV, savedRangeRightAPV);
-  servo.writeRawRegister(
-    HD_REG_RANGE_CENTER_APV, savedRangeCenterAPV);
-  servo.writeRawRegister(
-    HD_REG_SPEED, savedSpeed);
-  servo.writeRawRegister(
-    HD_REG_POWER_LIMIT, savedPowerLimit);
-
-  servo.writeRawRegister(HD_REG_SAVE, HD_SAVE_CONST);
-  servo.writeRawRegister(HD_REG_REBOOT, HD_REBOOT_CONST);
-  delay(1000);
+  int res;
+  if ((res = servo.revertVolatile(settingsBeforeGentleMovement)) !=
+      HITECD_OK) {
+    printErr(res, true);
+  }
 
   /* Read back the settings to make sure we have the latest values. */
-  int res;
   if ((res = servo.readSettings(&settings)) != HITECD_OK) {
     printErr(res, true);
   }
 
+  servo.setMoveCompleteThresholds(
+    HITECD_MOVE_DEFAULT_MAX_VELOCITY, HITECD_MOVE_DEFAULT_MAX_TRACKING_ERROR);
+
   Serial.println(F("Done."));
   usingGentleMovementSettings = false;
 }
@@ -171,20 +141,13 @@ void moveGentlyToAPV(int16_t targetAPV, int16_t *actualAPV) {
   servo.writeTargetQuarterMicros(targetQuarterMicros);
 
   /* Wait until it seems to have successfully moved */
-  int16_t lastActualAPV = servo.readCurrentAPV();
-  if (lastActualAPV < 0) {
-    printErr(lastActualAPV, true);
+  int res = servo.waitForMoveComplete(5000);
+  if (res != HITECD_OK && res != HITECD_ERR_MOVE_TIMEOUT) {
+    printErr(res, true);
   }
-  for (int i = 0; i < 50; ++i) {
-    delay(100);
-    *actualAPV = servo.readCurrentAPV();
-    if (*actualAPV < 0) {
-      printErr(*actualAPV, true);
-    }
-    if (abs(lastActualAPV - *actualAPV) <= 3) {
-      break;
-    }
-    lastActualAPV = *actualAPV;
+  *actualAPV = servo.readCurrentAPV();
+  if (*actualAPV < 0) {
+    printErr(*actualAPV, true);
   }
 }
 
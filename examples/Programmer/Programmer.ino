@@ -121,6 +121,8 @@ void printHelp() {
     "  smartsense  - Change smart sense setting"));
   Serial.println(F(
     "  sensitivity - Change sensitivity ratio setting"));
+  Serial.println(F(
+    "  image       - Print a settings image of the current settings"));
   Serial.println(F(
     "  reset       - Reset all settings to factory defaults"));
   Serial.println(F(
@@ -159,6 +161,8 @@ void loop() {
     changeSmartSenseSetting();
   } else if (parseWord(F("sensitivity"))) {
     changeSensitivityRatioSetting();
+  } else if (parseWord(F("image"))) {
+    printSettingsImage();
   } else if (parseWord(F("reset"))) {
     resetSettingsToFactoryDefaults();
   } else if (parseWord(F("help"))) {
@@ -45,15 +45,13 @@ void saveSettings() {
 
   res = servo.writeSettingsUnsupportedModelThisMightDamageTheServo(
     settings,
-    allowUnsupportedModel
+    allowUnsupportedModel,
+    HITECD_WRITE_WAIT_UNTIL_READY
   );
   if (res != HITECD_OK) {
     printErr(res, true);
   }
 
-  /* Wait for servo to reboot */
-  delay(1000);
-
   /* Read back the settings to make sure we have the latest values. */
   if ((res = servo.readSettings(&settings)) != HITECD_OK) {
     printErr(res, true);
@@ -449,6 +447,35 @@ cancel:
   Serial.println(F("Current sensitivity ratio will be kept."));
 }
 
+void printSettingsImage() {
+  uint8_t image[HITECD_SETTINGS_IMAGE_MAX_LEN];
+  int len = servo.encodeSettingsImage(settings, image, sizeof(image));
+  if (len < 0) {
+    printErr(len, false);
+    return;
+  }
+
+  Serial.println(F(
+    "Settings image for the current settings. Paste this into a sketch and\r\n"
+    "pass it to applySettingsImage() to apply these settings to another\r\n"
+    "servo of the same model:"));
+  Serial.print(F("const uint8_t settingsImage[] PROGMEM = {"));
+  for (int i = 0; i < len; ++i) {
+    if (i == 0 || (i - HITECD_IMAGE_HEADER_LEN) % HITECD_IMAGE_FRAME_LEN == 0) {
+      Serial.print(F("\r\n "));
+    }
+    Serial.print(F(" 0x"));
+    if (image[i] < 0x10) {
+      Serial.print('0');
+    }
+    Serial.print(image[i], HEX);
+    if (i + 1 < len) {
+      Serial.print(',');
+    }
+  }
+  Serial.println(F("\r\n};"));
+}
+
 void resetSettingsToFactoryDefaults() {
   /* Print a copy of the servo settings, so the user has a backup copy of the
   previous settings if they change their mind after resetting it. */
@@ -39,6 +39,8 @@ void changeSmartSenseSetting();
 void printSensitivityRatioSetting();
 void changeSensitivityRatioSetting();
 
+void printSettingsImage();
+
 void resetSettingsToFactoryDefaults();
 
 #endif /* Settings_h */
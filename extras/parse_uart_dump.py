@@ -38,6 +38,13 @@ REG_NAMES = {
   0x6E: "HD_REG_FACTORY_RESET",
   0x1E: "HD_REG_TARGET",
   0x0C: "HD_REG_CURRENT_APV",
+  0x0E: "HD_REG_VELOCITY",
+  0xDE: "HD_REG_VELOCITY_2",
+  0x10: "HD_REG_MOTOR_POWER",
+  0x22: "HD_REG_EFFECTIVE_POWER_LIMIT",
+  0xE4: "HD_REG_TARGET_APV",
+  0xEA: "HD_REG_TRACKING_ERROR",
+  0xEC: "HD_REG_TRAVEL_DIRECTION",
   0x98: "HD_REG_MYSTERY_OP1",
   0x9A: "HD_REG_MYSTERY_OP2",
   0x72: "HD_REG_MYSTERY_DB",
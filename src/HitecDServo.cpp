@@ -1,8 +1,34 @@
 #include "HitecDServo.h"
 
 #include "HitecDServoInternal.h"
-
-HitecDServo::HitecDServo() : pin(-1) { }
+#include "HitecDServoBitEngine.h"
+#include "HitecDServoTimer.h"
+
+volatile bool hitecdTimerBusy = false;
+uint8_t hitecdTimerRxBuffer[HD_TIMER_MAX_FRAME_LEN];
+volatile uint8_t hitecdTimerRxCount;
+
+HitecDServo::HitecDServo() :
+  pin(-1),
+  timerWriteFrame(NULL),
+  timerReceiver(NULL),
+  readState(HD_READ_IDLE),
+  readCooldownMicros(HD_READ_COOLDOWN_US),
+  registerCache(NULL),
+  eepromNumSlots(0),
+  eepromSlot(-1),
+  eepromValid(false),
+  unsavedWrites(false),
+  session(NULL),
+  saveCount(0),
+  saveBudget(0),
+  moveMaxVelocity(HITECD_MOVE_DEFAULT_MAX_VELOCITY),
+  moveMaxTrackingError(HITECD_MOVE_DEFAULT_MAX_TRACKING_ERROR),
+  moveSettledReads(1),
+  moveState(HD_MOVE_IDLE)
+{
+  latencyStats.samples = 0;
+}
 
 int HitecDServo::attach(int _pin) {
   if (attached()) {
@@ -18,6 +44,13 @@ int HitecDServo::attach(int _pin) {
   pinInputRegister = portInputRegister(port);
   pinOutputRegister = portOutputRegister(port);
 
+  /* This might be a different servo now. */
+  useRegisterCache(registerCache);
+  session = NULL;
+
+  /* The reads below also measure the servo's response latency. */
+  latencyStats.samples = 0;
+
   int res;
   uint16_t temp;
 
@@ -27,24 +60,44 @@ int HitecDServo::attach(int _pin) {
   }
   modelNumber = temp;
 
-  if ((res = readRawRegister(HD_REG_RANGE_LEFT_APV, &temp)) != HITECD_OK) {
-    detachAndReset();
-    return res;
+  /* If we've seen this servo before, the range is in the EEPROM. */
+  eepromSlot = -1;
+  eepromValid = false;
+  if (eepromNumSlots != 0) {
+    if ((res = readRawRegister(HD_REG_FINGERPRINT, &fingerprint)) !=
+        HITECD_OK) {
+      detachAndReset();
+      return res;
+    }
+    HitecDSettings settings;
+    if (loadEEPROMSettings(&settings)) {
+      rangeLeftAPV = settings.rangeLeftAPV;
+      rangeRightAPV = settings.rangeRightAPV;
+      rangeCenterAPV = settings.rangeCenterAPV;
+      return HITECD_OK;
+    }
   }
-  rangeLeftAPV = temp;
 
-  if ((res = readRawRegister(HD_REG_RANGE_RIGHT_APV, &temp)) != HITECD_OK) {
+  if ((res = readRange()) != HITECD_OK) {
     detachAndReset();
     return res;
   }
-  rangeRightAPV = temp;
 
-  if ((res = readRawRegister(HD_REG_RANGE_CENTER_APV, &temp)) != HITECD_OK) {
-    detachAndReset();
+  return HITECD_OK;
+}
+
+int HitecDServo::readRange() {
+  static const uint8_t regs[3] = {
+    HD_REG_RANGE_LEFT_APV, HD_REG_RANGE_RIGHT_APV, HD_REG_RANGE_CENTER_APV
+  };
+  uint16_t vals[3];
+  int res = readRawRegisters(regs, 3, vals);
+  if (res != HITECD_OK) {
     return res;
   }
-  rangeCenterAPV = temp;
-
+  rangeLeftAPV = vals[0];
+  rangeRightAPV = vals[1];
+  rangeCenterAPV = vals[2];
   return HITECD_OK;
 }
 
@@ -56,6 +109,9 @@ void HitecDServo::detachAndReset() {
   writeRawRegister(HD_REG_REBOOT, HD_REBOOT_CONST);
 
   pin = -1;
+  readState = HD_READ_IDLE;
+  readCooldownMicros = HD_READ_COOLDOWN_US;
+  moveState = HD_MOVE_IDLE;
 }
 
 void HitecDServo::writeTargetMicroseconds(int16_t microseconds) {
@@ -102,205 +158,357 @@ int16_t HitecDServo::readCurrentAPV() {
   return currentAPV;
 }
 
-int HitecDServo::readModelNumber() {
-  if (!attached()) {
-    return HITECD_ERR_NOT_ATTACHED;
-  }
-  return modelNumber;
+/* The register for each HITECD_TELEMETRY_* flag, in bit order */
+static const uint8_t telemetryRegs[8] = {
+  HD_REG_CURRENT_APV,
+  HD_REG_VELOCITY,
+  HD_REG_VELOCITY_2,
+  HD_REG_MOTOR_POWER,
+  HD_REG_EFFECTIVE_POWER_LIMIT,
+  HD_REG_TARGET_APV,
+  HD_REG_TRACKING_ERROR,
+  HD_REG_TRAVEL_DIRECTION,
+};
+
+int HitecDServo::readTelemetry(HitecDTelemetry *telemetryOut) {
+  return readTelemetry(telemetryOut, HITECD_TELEMETRY_ALL);
 }
 
-bool HitecDServo::isModelSupported() {
+int HitecDServo::readTelemetry(
+  HitecDTelemetry *telemetryOut,
+  uint8_t fieldMask
+) {
+  /* Fields from earlier calls aren't valid anymore */
+  telemetryOut->validMask = 0;
   if (!attached()) {
-    return false;
+    return HITECD_ERR_NOT_ATTACHED;
   }
-  switch (modelNumber) {
-    case HD_MODEL_NUMBER_D485HW: return true;
-    default: return false;
+
+  int firstErr = HITECD_OK;
+  uint8_t remaining = fieldMask;
+  for (uint8_t i = 0; remaining != 0; ++i) {
+    uint8_t field = 1 << i;
+    if (!(remaining & field)) {
+      continue;
+    }
+    remaining &= ~field;
+
+    /* As in readRawRegisters(), only the last read needs the full cooldown. */
+    if (remaining != 0) {
+      readCooldownMicros = HD_READ_BATCH_GAP_US;
+    }
+    uint16_t val;
+    int res = readRawRegister(telemetryRegs[i], &val);
+    readCooldownMicros = HD_READ_COOLDOWN_US;
+    if (res != HITECD_OK) {
+      if (firstErr == HITECD_OK) {
+        firstErr = res;
+      }
+      continue;
+    }
+    telemetryOut->validMask |= field;
+
+    unsigned long when = readStartMicros;
+    switch (field) {
+    case HITECD_TELEMETRY_CURRENT_APV:
+      telemetryOut->currentAPV = val;
+      telemetryOut->currentAPVMicros = when;
+      break;
+    case HITECD_TELEMETRY_VELOCITY:
+      telemetryOut->velocity = val;
+      telemetryOut->velocityMicros = when;
+      break;
+    case HITECD_TELEMETRY_VELOCITY_2:
+      telemetryOut->velocity2 = val;
+      telemetryOut->velocity2Micros = when;
+      break;
+    case HITECD_TELEMETRY_MOTOR_POWER:
+      telemetryOut->motorPower = val;
+      telemetryOut->motorPowerMicros = when;
+      break;
+    case HITECD_TELEMETRY_EFFECTIVE_POWER_LIMIT:
+      telemetryOut->effectivePowerLimit = val;
+      telemetryOut->effectivePowerLimitMicros = when;
+      break;
+    case HITECD_TELEMETRY_TARGET_APV:
+      telemetryOut->targetAPV = val;
+      telemetryOut->targetAPVMicros = when;
+      break;
+    case HITECD_TELEMETRY_TRACKING_ERROR:
+      telemetryOut->trackingError = val;
+      telemetryOut->trackingErrorMicros = when;
+      break;
+    case HITECD_TELEMETRY_TRAVEL_DIRECTION:
+      telemetryOut->travelDirection = (val == 0xFFFF) ? -1 : 1;
+      telemetryOut->travelDirectionMicros = when;
+      break;
+    }
   }
+  return firstErr;
 }
 
-int HitecDServo::readSettings(HitecDSettings *settingsOut) {
+void HitecDServo::setMoveCompleteThresholds(
+  int16_t maxVelocity,
+  int16_t maxTrackingError,
+  uint8_t settledReads
+) {
+  moveMaxVelocity = maxVelocity;
+  moveMaxTrackingError = maxTrackingError;
+  moveSettledReads = settledReads > 0 ? settledReads : 1;
+}
+
+int HitecDServo::isMoving() {
   if (!attached()) {
     return HITECD_ERR_NOT_ATTACHED;
   }
 
+  HitecDTelemetry telemetry;
+  uint8_t fieldMask = HITECD_TELEMETRY_VELOCITY;
+  if (moveMaxTrackingError >= 0) {
+    fieldMask |= HITECD_TELEMETRY_TRACKING_ERROR;
+  }
   int res;
-  uint16_t temp;
-
-  /* Read ID */
-  if ((res = readRawRegister(HD_REG_ID, &temp)) != HITECD_OK) {
+  if ((res = readTelemetry(&telemetry, fieldMask)) != HITECD_OK) {
     return res;
   }
-  if (temp > 255) {
-    return HITECD_ERR_CONFUSED;
-  }
-  settingsOut->id = temp;
 
-  /* Read counterclockwise */
-  if ((res = readRawRegister(HD_REG_DIRECTION, &temp)) != HITECD_OK) {
-    return res;
+  if (abs(telemetry.velocity) > moveMaxVelocity) {
+    return 1;
   }
-  if (temp == HD_DIRECTION_CLOCKWISE) {
-    settingsOut->counterclockwise = false;
-  } else if (temp == HD_DIRECTION_COUNTERCLOCKWISE) {
-    settingsOut->counterclockwise = true;
-  } else {
-    return HITECD_ERR_CONFUSED;
+  if (moveMaxTrackingError >= 0 &&
+      abs(telemetry.trackingError) > moveMaxTrackingError) {
+    return 1;
   }
+  return 0;
+}
 
-  /* Read speed */
-  if ((res = readRawRegister(HD_REG_SPEED, &temp)) != HITECD_OK) {
+int HitecDServo::waitForMoveComplete(unsigned long timeoutMillis) {
+  int res;
+  if ((res = beginWaitForMoveComplete(timeoutMillis)) != HITECD_OK) {
     return res;
   }
-  if (temp == 0x0FFF) {
-    settingsOut->speed = 100;
-  } else if (temp < 20) {
-    settingsOut->speed = temp*5;
-  } else {
-    return HITECD_ERR_CONFUSED;
-  }
+  while ((res = pollWaitForMoveComplete()) == HITECD_PENDING) { }
+  return res;
+}
 
-  /* Read deadband. There are three deadband-related registers, and their values
-  are expected to be consistent with each other. We used to read all three
-  registers and assert the values were consistent; but occasionally the latter
-  two registers would read as 0, causing failures. So now we just read the first
-  register. The DPC-11 software also only reads the first register. */
-  uint16_t deadband_1;
-  if ((res = readRawRegister(HD_REG_DEADBAND_1, &deadband_1)) != HITECD_OK) {
-    return res;
-  }
-  if (deadband_1 == 1) {
-    settingsOut->deadband = 1;
-  } else if (deadband_1 >= 4 && deadband_1 <= 36 && deadband_1 % 4 == 0) {
-    settingsOut->deadband = deadband_1 / 4 + 1;
-  } else {
-    return HITECD_ERR_CONFUSED;
-  }
+/* Each check is usually followed right away by the next one (or by the
+tracking error read), so like readRawRegisters(), only leave a short gap after
+each read. pollWaitForMoveComplete() puts the full cooldown back when the read
+finishes. */
+int HitecDServo::beginMoveCheckRead(uint8_t reg) {
+  readCooldownMicros = HD_READ_BATCH_GAP_US;
+  int res = beginReadRawRegister(reg);
+  if (res != HITECD_OK) {
+    readCooldownMicros = HD_READ_COOLDOWN_US;
+    moveState = HD_MOVE_IDLE;
+  }
+  return res;
+}
 
-  /* Read softStart */
-  if ((res = readRawRegister(HD_REG_SOFT_START, &temp)) != HITECD_OK) {
-    return res;
+int HitecDServo::beginWaitForMoveComplete(unsigned long timeoutMillis) {
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
   }
-  if (temp == HD_SOFT_START_20) {
-    settingsOut->softStart = 20;
-  } else if (temp == HD_SOFT_START_40) {
-    settingsOut->softStart = 40;
-  } else if (temp == HD_SOFT_START_60) {
-    settingsOut->softStart = 60;
-  } else if (temp == HD_SOFT_START_80) {
-    settingsOut->softStart = 80;
-  } else if (temp == HD_SOFT_START_100) {
-    settingsOut->softStart = 100;
-  } else {
-    return HITECD_ERR_CONFUSED;
+  if (moveState != HD_MOVE_IDLE) {
+    return HITECD_ERR_BUSY;
   }
+  moveStartMillis = millis();
+  moveTimeoutMillis = timeoutMillis;
+  moveSettledCount = 0;
+  moveState = HD_MOVE_READ_VELOCITY;
+  return beginMoveCheckRead(HD_REG_VELOCITY);
+}
 
-  /* Read rangeLeftAPV, rangeRightAPV, rangeCenterAPV */
-  if ((res = readRawRegister(HD_REG_RANGE_LEFT_APV, &temp)) != HITECD_OK) {
-    return res;
+int HitecDServo::pollWaitForMoveComplete() {
+  if (moveState == HD_MOVE_IDLE) {
+    /* beginWaitForMoveComplete() wasn't called */
+    return attached() ? HITECD_ERR_CONFUSED : HITECD_ERR_NOT_ATTACHED;
   }
-  settingsOut->rangeLeftAPV = rangeLeftAPV = temp;
 
-  if ((res = readRawRegister(HD_REG_RANGE_RIGHT_APV, &temp)) != HITECD_OK) {
-    return res;
+  uint16_t val;
+  int res = pollReadRawRegister(&val);
+  if (res == HITECD_PENDING) {
+    return HITECD_PENDING;
   }
-  settingsOut->rangeRightAPV = rangeRightAPV = temp;
-
-  if ((res = readRawRegister(HD_REG_RANGE_CENTER_APV, &temp)) != HITECD_OK) {
+  readCooldownMicros = HD_READ_COOLDOWN_US;
+  if (res != HITECD_OK) {
+    moveState = HD_MOVE_IDLE;
     return res;
   }
-  settingsOut->rangeCenterAPV = rangeCenterAPV = temp;
 
-  /* Read failSafe and failSafeLimp. (A single register controls both.) */
-  if ((res = readRawRegister(HD_REG_FAIL_SAFE, &temp)) != HITECD_OK) {
-    return res;
-  }
-  if (temp >= 850 && temp <= 2150) {
-    settingsOut->failSafe = temp;
-    settingsOut->failSafeLimp = false;
-  } else if (temp == 0) {
-    settingsOut->failSafe = 0;
-    settingsOut->failSafeLimp = true;
-  } else if (temp == 1) {
-    settingsOut->failSafe = 0;
-    settingsOut->failSafeLimp = false;
+  bool settled;
+  if (moveState == HD_MOVE_READ_VELOCITY) {
+    settled = abs((int16_t)val) <= moveMaxVelocity;
+    if (settled && moveMaxTrackingError >= 0) {
+      moveState = HD_MOVE_READ_TRACKING_ERROR;
+      res = beginMoveCheckRead(HD_REG_TRACKING_ERROR);
+      return res == HITECD_OK ? HITECD_PENDING : res;
+    }
   } else {
-    return HITECD_ERR_CONFUSED;
+    settled = abs((int16_t)val) <= moveMaxTrackingError;
   }
 
-  /* Read powerLimit */
-  if ((res = readRawRegister(HD_REG_POWER_LIMIT, &temp)) != HITECD_OK) {
-    return res;
-  }
-  if (temp == 0x0FFF) {
-    settingsOut->powerLimit = 100;
+  if (settled) {
+    if (++moveSettledCount >= moveSettledReads) {
+      moveState = HD_MOVE_IDLE;
+      return HITECD_OK;
+    }
   } else {
-    /* Divide rounding up, so nonzero values stay nonzero */
-    settingsOut->powerLimit = (temp + 19) / 20;
+    moveSettledCount = 0;
   }
 
-  /* Read overloadProtection */
-  if ((res = readRawRegister(HD_REG_OVERLOAD_PROTECTION, &temp)) != HITECD_OK) {
-    return res;
+  if (millis() - moveStartMillis >= moveTimeoutMillis) {
+    moveState = HD_MOVE_IDLE;
+    return HITECD_ERR_MOVE_TIMEOUT;
   }
-  settingsOut->overloadProtection = temp;
+  moveState = HD_MOVE_READ_VELOCITY;
+  res = beginMoveCheckRead(HD_REG_VELOCITY);
+  return res == HITECD_OK ? HITECD_PENDING : res;
+}
 
-  /* Read smartSense. smartSense is controlled by two registers, 0x6C and 0x44.
-  If smartSense is enabled, these should be set to values read from two
-  read-only registers, 0xD4 and 0xD6. If smartSense is disabled, these should be
-  set to values read from two other read-only registers, 0x8A and 0x8C. So we
-  read all six registers and confirm the values follow one of the two expected
-  patterns. */
-  uint16_t ss_1, ss_2, ss_enable_1, ss_enable_2, ss_disable_1, ss_disable_2;
-  if ((res = readRawRegister(HD_REG_SMART_SENSE_1, &ss_1)) != HITECD_OK) {
-    return res;
+int HitecDServo::readModelNumber() {
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
   }
-  if ((res = readRawRegister(HD_REG_SMART_SENSE_2, &ss_2)) != HITECD_OK) {
-    return res;
+  return modelNumber;
+}
+
+bool HitecDServo::isModelSupported() {
+  if (!attached()) {
+    return false;
   }
-  if ((res = readRawRegister(HD_REG_SS_ENABLE_1, &ss_enable_1)) != HITECD_OK) {
-    return res;
+  HitecDModelProfile profile;
+  return hitecdFindModelProfile(modelNumber, &profile) &&
+    (profile.flags & HD_MODEL_SUPPORTED);
+}
+
+/* Retrieves the values of SS_ENABLE_1, SS_ENABLE_2, SS_DISABLE_1, and
+SS_DISABLE_2, in that order. These are per-model constants, so for models in
+the profile table we don't need to read them. */
+int HitecDServo::readSmartSenseConstants(uint16_t *ssConstsOut) {
+  HitecDModelProfile profile;
+  if (hitecdFindModelProfile(modelNumber, &profile)) {
+    ssConstsOut[0] = profile.ssEnable1;
+    ssConstsOut[1] = profile.ssEnable2;
+    ssConstsOut[2] = profile.ssDisable1;
+    ssConstsOut[3] = profile.ssDisable2;
+    return HITECD_OK;
+  }
+  static const uint8_t regs[4] = {
+    HD_REG_SS_ENABLE_1,
+    HD_REG_SS_ENABLE_2,
+    HD_REG_SS_DISABLE_1,
+    HD_REG_SS_DISABLE_2
+  };
+  return readRawRegisters(regs, 4, ssConstsOut);
+}
+
+int HitecDServo::readSettings(HitecDSettings *settingsOut) {
+  return readSettings(settingsOut, HITECD_FIELD_ALL);
+}
+
+int HitecDServo::readSettings(
+  HitecDSettings *settingsOut,
+  uint16_t fieldMask
+) {
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
   }
-  if ((res = readRawRegister(HD_REG_SS_ENABLE_2, &ss_enable_2)) != HITECD_OK) {
-    return res;
+
+  int res;
+
+  if (eepromValid) {
+    HitecDSettings settings;
+    if (loadEEPROMSettings(&settings)) {
+      hitecdCopySettings(settings, settingsOut, fieldMask);
+      return HITECD_OK;
+    }
   }
-  if ((res = readRawRegister(HD_REG_SS_DISABLE_1, &ss_disable_1)) != HITECD_OK) {
-    return res;
+
+  /* Gather the registers for all the requested fields, so they can be read in
+  one batch. */
+  uint8_t regs[HD_SETTINGS_NUM_READ_REGS];
+  uint16_t vals[HD_SETTINGS_NUM_READ_REGS];
+  uint8_t n = 0;
+  bool needSSConsts = false;
+  HitecDSettingsCodec codec;
+  for (uint8_t i = 0; i < HD_NUM_SETTINGS_CODECS; ++i) {
+    hitecdGetSettingsCodec(i, &codec);
+    if (fieldMask & codec.field) {
+      n += hitecdCodecReadRegs(codec, &regs[n]);
+      if (codec.flags & HD_CODEC_SS_CONSTS) {
+        needSSConsts = true;
+      }
+    }
   }
-  if ((res = readRawRegister(HD_REG_SS_DISABLE_2, &ss_disable_2)) != HITECD_OK) {
+  if ((res = readRawRegisters(regs, n, vals)) != HITECD_OK) {
     return res;
   }
-  if (ss_1 == ss_enable_1 && ss_2 == ss_enable_2) {
-    settingsOut->smartSense = true;
-  } else if (ss_1 == ss_disable_1 && ss_2 == ss_disable_2) {
-    settingsOut->smartSense = false;
-  } else {
-    return HITECD_ERR_CONFUSED;
+
+  /* Decoding smartSense also needs the four read-only SS_* registers (or their
+  values from the model profile). */
+  uint16_t ssConsts[4];
+  if (needSSConsts) {
+    if ((res = readSmartSenseConstants(ssConsts)) != HITECD_OK) {
+      return res;
+    }
   }
 
-  /* Read sensitivityRatio */
-  if ((res = readRawRegister(HD_REG_SENSITIVITY_RATIO, &temp)) != HITECD_OK) {
-    return res;
+  n = 0;
+  for (uint8_t i = 0; i < HD_NUM_SETTINGS_CODECS; ++i) {
+    hitecdGetSettingsCodec(i, &codec);
+    if (fieldMask & codec.field) {
+      res = hitecdDecodeSetting(codec, &vals[n], ssConsts, settingsOut);
+      if (res != HITECD_OK) {
+        return res;
+      }
+      n += hitecdCodecReadRegs(codec, &regs[n]);
+    }
   }
-  if (temp >= HD_SENSITIVITY_RATIO_MIN && temp <= HD_SENSITIVITY_RATIO_MAX) {
-    settingsOut->sensitivityRatio = temp;
-  } else {
-    return HITECD_ERR_CONFUSED;
+
+  if (fieldMask & HITECD_FIELD_RANGE) {
+    rangeLeftAPV = settingsOut->rangeLeftAPV;
+    rangeRightAPV = settingsOut->rangeRightAPV;
+    rangeCenterAPV = settingsOut->rangeCenterAPV;
+  }
+
+  /* Only cache settings that the servo has saved; otherwise they'd be wrong
+  after the next power cycle. */
+  if (fieldMask == HITECD_FIELD_ALL && !unsavedWrites &&
+      !(registerCache && registerCache->dirty)) {
+    storeEEPROMSettings(*settingsOut);
   }
 
   return HITECD_OK;
 }
 
-int HitecDServo::writeSettings(const HitecDSettings &settings) {
-  return writeSettingsUnsupportedModelThisMightDamageTheServo(settings, false);
+/* Replaces ranges of -1 with the model's factory defaults. (They stay -1 if
+the defaults aren't known.) */
+static void resolveDefaultRanges(HitecDSettings *settings, int modelNumber) {
+  if (settings->rangeLeftAPV == -1) {
+    settings->rangeLeftAPV = HitecDSettings::defaultRangeLeftAPV(modelNumber);
+  }
+  if (settings->rangeRightAPV == -1) {
+    settings->rangeRightAPV =
+      HitecDSettings::defaultRangeRightAPV(modelNumber);
+  }
+  if (settings->rangeCenterAPV == -1) {
+    settings->rangeCenterAPV =
+      HitecDSettings::defaultRangeCenterAPV(modelNumber);
+  }
+}
+
+int HitecDServo::writeSettings(const HitecDSettings &settings, uint8_t flags) {
+  return writeSettingsUnsupportedModelThisMightDamageTheServo(settings, false,
+    flags);
 }
 
 int HitecDServo::writeSettingsUnsupportedModelThisMightDamageTheServo(
   const HitecDSettings &settings,
-  bool allowUnsupportedModel
+  bool allowUnsupportedModel,
+  uint8_t flags
 ) {
   int res;
-  uint16_t temp;
 
   if (!attached()) {
     return HITECD_ERR_NOT_ATTACHED;
@@ -310,6 +518,14 @@ int HitecDServo::writeSettingsUnsupportedModelThisMightDamageTheServo(
     return HITECD_ERR_UNSUPPORTED_MODEL;
   }
 
+  if (saveBudgetExhausted()) {
+    return HITECD_ERR_SAVE_BUDGET;
+  }
+
+  if (flags & HITECD_WRITE_DELTA) {
+    return writeSettingsDelta(settings, flags);
+  }
+
   /* Reset to factory defaults. (We'll then ignore any settings that are already
   at the factory defaults.) */
   writeRawRegister(HD_REG_FACTORY_RESET, HD_FACTORY_RESET_CONST);
@@ -320,319 +536,1172 @@ int HitecDServo::writeSettingsUnsupportedModelThisMightDamageTheServo(
   writeRawRegister(HD_REG_MYSTERY_OP1, HD_MYSTERY_OP1_CONST);
   writeRawRegister(HD_REG_MYSTERY_OP2, HD_MYSTERY_OP2_CONST);
 
-  /* Write id */
-  if (settings.id != HitecDSettings::defaultId) {
-    writeRawRegister(HD_REG_ID, settings.id);
-  }
-
-  /* Write counterclockwise */
-  if (settings.counterclockwise) {
-    writeRawRegister(HD_REG_DIRECTION, HD_DIRECTION_COUNTERCLOCKWISE);
-  }
-
-  /* Write speed */
-  if (settings.speed != HitecDSettings::defaultSpeed) {
-    writeRawRegister(HD_REG_SPEED, settings.speed / 5);
-  }
-
-  /* Write deadband */
-  if (settings.deadband != HitecDSettings::defaultDeadband) {
-    /* The DPC-11 always writes this register to the this constant whenever it
-    changes the deadband. I'm not sure why, but we do the same to be safe. */
-    writeRawRegister(HD_REG_MYSTERY_DB, HD_MYSTERY_DB_CONST);
- 
-    /* Note, these formulas are wrong if deadband=1, but deadband=1 is the
-    factory default, so that's OK. */
-    writeRawRegister(HD_REG_DEADBAND_1, 4 * settings.deadband - 4);
-    writeRawRegister(HD_REG_DEADBAND_2, 4 * settings.deadband);
-    writeRawRegister(HD_REG_DEADBAND_3, 4 * settings.deadband + 6);
-  }
-
-  /* Write softStart */
-  if (settings.softStart != HitecDSettings::defaultSoftStart) {
-    /* Note, we omit the softStart=20 case because it's the factory default. */
-    if (settings.softStart == 40) {
-      writeRawRegister(HD_REG_SOFT_START, HD_SOFT_START_40);
-    } else if (settings.softStart == 60) {
-      writeRawRegister(HD_REG_SOFT_START, HD_SOFT_START_60);
-    } else if (settings.softStart == 80) {
-      writeRawRegister(HD_REG_SOFT_START, HD_SOFT_START_80);
-    } else if (settings.softStart == 100) {
-      writeRawRegister(HD_REG_SOFT_START, HD_SOFT_START_100);
-    }
-  }
-
-  /* Write rangeLeftAPV, rangeRightAPV, and rangeCenterAPV. Also, update the
-  instance variables that we initialized in attach(). (If we're using the
-  default values, then read them back into instance variables, so we have the
-  correct default values.) */
-  if (settings.rangeLeftAPV != -1 &&
-      settings.rangeLeftAPV !=
-        HitecDSettings::defaultRangeLeftAPV(modelNumber)) {
-    writeRawRegister(HD_REG_RANGE_LEFT_APV, settings.rangeLeftAPV);
-    rangeLeftAPV = settings.rangeLeftAPV;
-  } else {
-    if ((res = readRawRegister(HD_REG_RANGE_LEFT_APV, &temp)) != HITECD_OK) {
+  /* Write the settings that differ from the factory defaults. */
+  HitecDSettings target = settings, defaults;
+  resolveDefaultRanges(&target, modelNumber);
+  resolveDefaultRanges(&defaults, modelNumber);
+  bool changed, reboot;
+  res = writeChangedSettings(target, defaults, &changed, &reboot);
+  if (res != HITECD_OK) {
+    return res;
+  }
+
+  /* Update the instance variables that we initialized in attach(). If we don't
+  know this model's default range, read back the values the factory reset left
+  behind. */
+  if (target.rangeLeftAPV == -1 || target.rangeRightAPV == -1 ||
+      target.rangeCenterAPV == -1) {
+    if ((res = readSettings(&target, HITECD_FIELD_RANGE)) != HITECD_OK) {
       return res;
     }
-    rangeLeftAPV = temp;
   }
+  rangeLeftAPV = target.rangeLeftAPV;
+  rangeRightAPV = target.rangeRightAPV;
+  rangeCenterAPV = target.rangeCenterAPV;
+  storeEEPROMSettings(target);
 
-  if (settings.rangeRightAPV != -1 &&
-      settings.rangeRightAPV !=
-        HitecDSettings::defaultRangeRightAPV(modelNumber)) {
-    writeRawRegister(HD_REG_RANGE_RIGHT_APV, settings.rangeRightAPV);
-    rangeRightAPV = settings.rangeRightAPV;
-  } else {
-     if ((res = readRawRegister(HD_REG_RANGE_RIGHT_APV, &temp)) != HITECD_OK) {
+  /* Save new settings to EEPROM */
+  writeRawRegister(HD_REG_SAVE, HD_SAVE_CONST);
+
+  /* Reboot the servo so the new settings take effect */
+  writeRawRegister(HD_REG_REBOOT, HD_REBOOT_CONST);
+
+  /* After writing to REBOOT, the servo will take 1000ms to boot. During this
+  time, it won't respond to commands. Unless HITECD_WRITE_WAIT_UNTIL_READY was
+  passed, the caller is responsible for waiting 1000ms before trying to issue
+  any commands. */
+  if (flags & HITECD_WRITE_WAIT_UNTIL_READY) {
+    if ((res = waitUntilReady(HD_BOOT_TIMEOUT_MS)) != HITECD_OK) {
       return res;
     }
-    rangeRightAPV = temp;
   }
 
-  if (settings.rangeCenterAPV != -1 &&
-      settings.rangeCenterAPV !=
-        HitecDSettings::defaultRangeCenterAPV(modelNumber)) {
-    writeRawRegister(HD_REG_RANGE_CENTER_APV, settings.rangeCenterAPV);
-    rangeCenterAPV = settings.rangeCenterAPV;
-  } else {
-    if ((res = readRawRegister(HD_REG_RANGE_CENTER_APV, &temp)) != HITECD_OK) {
-      return res;
+  /* After 1000ms elapses, the HPC-11 writes 0x1000 to register 0x22. I'm not
+  sure what this is for; register 0x22 stores the calculated power limit (after
+  applying overload protection) and writing to it appears to have no effect.
+  This library doesn't write to register 0x22. */
+
+  return HITECD_OK;
+}
+
+/* Settings registers that only take effect after the servo reboots. This is
+based on which settings the DPC-11 reboots the servo after changing (see
+extras/DPC11Notes.md). The other settings registers (SPEED, SOFT_START,
+POWER_LIMIT, OVERLOAD_PROTECTION, and MYSTERY_OP1/2) take effect immediately;
+the DPC-11 just saves them. FAIL_SAFE is in between: the DPC-11 reboots the
+servo after turning FS_limp on or off, but not after changing the fail-safe
+point or turning fail-safe on or off otherwise (see requiresReboot()). */
+static const uint8_t registersRequiringReboot[] PROGMEM = {
+  HD_REG_ID,
+  HD_REG_DIRECTION,
+  HD_REG_DEADBAND_1,
+  HD_REG_DEADBAND_2,
+  HD_REG_DEADBAND_3,
+  HD_REG_MYSTERY_DB,
+  HD_REG_RANGE_LEFT_APV,
+  HD_REG_RANGE_RIGHT_APV,
+  HD_REG_RANGE_CENTER_APV,
+  HD_REG_SMART_SENSE_1,
+  HD_REG_SMART_SENSE_2,
+  HD_REG_SENSITIVITY_RATIO
+};
+
+static bool failSafeIsLimp(const HitecDSettings &settings) {
+  return settings.failSafe == 0 && settings.failSafeLimp;
+}
+
+/* Returns whether writing `val` to `reg`, on a servo whose settings are
+`reference`, needs a reboot to take effect. */
+static bool requiresReboot(
+  uint8_t reg,
+  uint16_t val,
+  const HitecDSettings &reference
+) {
+  if (reg == HD_REG_FAIL_SAFE) {
+    return (val == HD_FAIL_SAFE_LIMP) != failSafeIsLimp(reference);
+  }
+  for (uint8_t i = 0; i < sizeof(registersRequiringReboot); ++i) {
+    if (pgm_read_byte(&registersRequiringReboot[i]) == reg) {
+      return true;
     }
-    rangeCenterAPV = temp;
   }
+  return false;
+}
+
+/* Returns whether changing from `reference` to `settings` needs a reboot. */
+static bool settingsNeedReboot(
+  const HitecDSettings &settings,
+  const HitecDSettings &reference
+) {
+  uint16_t ssConsts[4] = {0, 0, 0, 0};
+  uint8_t regs[HD_SETTINGS_MAX_WRITES];
+  uint16_t vals[HD_SETTINGS_MAX_WRITES];
+  uint8_t n = hitecdDiffSettings(settings, reference, ssConsts, regs, vals);
+  for (uint8_t i = 0; i < n; ++i) {
+    if (requiresReboot(regs[i], vals[i], reference)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void HitecDServo::writeSettingsRegister(
+  uint8_t reg,
+  uint16_t val,
+  const HitecDSettings &reference,
+  bool *rebootOut
+) {
+  writeRawRegister(reg, val);
+  if (requiresReboot(reg, val, reference)) {
+    *rebootOut = true;
+  }
+}
+
+int HitecDServo::applySettingsVolatile(
+  const HitecDSettings &settings,
+  HitecDSettings *previousOut
+) {
+  return applySettingsVolatileUnsupportedModelThisMightDamageTheServo(
+    settings, false, previousOut);
+}
 
-  /* Write failSafe and failSafeLimp (controlled by same register) */
-  if (settings.failSafe != 0) {
-    writeRawRegister(HD_REG_FAIL_SAFE, settings.failSafe);
-  } else if (settings.failSafeLimp) {
-    writeRawRegister(HD_REG_FAIL_SAFE, HD_FAIL_SAFE_LIMP);
+int HitecDServo::applySettingsVolatileUnsupportedModelThisMightDamageTheServo(
+  const HitecDSettings &settings,
+  bool allowUnsupportedModel,
+  HitecDSettings *previousOut
+) {
+  return applyVolatile(settings, allowUnsupportedModel, previousOut, false);
+}
+
+/* If `saveLive`, and the servo has to be saved and rebooted anyway, the
+settings that take effect immediately are saved too. */
+int HitecDServo::applyVolatile(
+  const HitecDSettings &settings,
+  bool allowUnsupportedModel,
+  HitecDSettings *previousOut,
+  bool saveLive
+) {
+  int res;
+
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
   }
 
-  /* Write powerLimit */
-  if (settings.powerLimit != HitecDSettings::defaultPowerLimit) {
-    writeRawRegister(HD_REG_POWER_LIMIT, settings.powerLimit * 20);
+  if (!isModelSupported() && !allowUnsupportedModel) {
+    return HITECD_ERR_UNSUPPORTED_MODEL;
   }
 
-  /* Write overloadProtection */
-  if (settings.overloadProtection !=
-      HitecDSettings::defaultOverloadProtection) {
-    writeRawRegister(HD_REG_OVERLOAD_PROTECTION, settings.overloadProtection);
+  HitecDSettings current;
+  if ((res = readSettings(&current)) != HITECD_OK) {
+    return res;
+  }
+  if (previousOut) {
+    *previousOut = current;
   }
 
-  /* Write smartSense */
-  if (!settings.smartSense) {
-    /* The DPC-11 always writes this register to the this constant whenever it
-    enables or disables smartSense. I'm not sure why, but we do the same to be
-    safe. */
-    writeRawRegister(HD_REG_MYSTERY_DB, HD_MYSTERY_DB_CONST);
+  HitecDSettings target = settings;
+  resolveDefaultRanges(&target, modelNumber);
+
+  if (settingsNeedReboot(target, current) && saveBudgetExhausted()) {
+    return HITECD_ERR_SAVE_BUDGET;
+  }
 
-    /* To disable smartSense, we have to read magic numbers from the two
-    SS_DISABLE_* registers and write them to the SMART_SENSE_* registers. */
-    if ((res = readRawRegister(HD_REG_SS_DISABLE_1, &temp)) != HITECD_OK) {
+  /* Registers that only take effect after a reboot have to be saved, because
+  rebooting discards everything that wasn't saved. SAVE also saves whatever the
+  other registers hold at that point, so they're still the current values; or,
+  if `saveLive`, the new ones. */
+  bool reboot, wrote;
+  if ((res = writeDiffRegisters(target, current, true, &reboot)) !=
+      HITECD_OK) {
+    return res;
+  }
+  if (reboot) {
+    if (saveLive) {
+      if ((res = writeDiffRegisters(target, current, false, &wrote)) !=
+          HITECD_OK) {
+        return res;
+      }
+    }
+    writeRawRegister(HD_REG_SAVE, HD_SAVE_CONST);
+    writeRawRegister(HD_REG_REBOOT, HD_REBOOT_CONST);
+    if ((res = waitUntilReady(HD_BOOT_TIMEOUT_MS)) != HITECD_OK) {
       return res;
     }
-    writeRawRegister(HD_REG_SMART_SENSE_1, temp);
+  }
 
-    if ((res = readRawRegister(HD_REG_SS_DISABLE_2, &temp)) != HITECD_OK) {
+  /* The rest take effect immediately, and are never saved. (This is also what
+  the DPC-11 does with POWER_LIMIT while it's adjusting the range.) */
+  if (!(reboot && saveLive)) {
+    if ((res = writeDiffRegisters(target, current, false, &wrote)) !=
+        HITECD_OK) {
       return res;
     }
-    writeRawRegister(HD_REG_SMART_SENSE_2, temp);
   }
 
-  /* Write sensitivityRatio */
-  if (settings.sensitivityRatio != HitecDSettings::defaultSensitivityRatio) {
-    writeRawRegister(HD_REG_SENSITIVITY_RATIO, settings.sensitivityRatio);
+  if (target.rangeLeftAPV != -1) {
+    rangeLeftAPV = target.rangeLeftAPV;
+  }
+  if (target.rangeRightAPV != -1) {
+    rangeRightAPV = target.rangeRightAPV;
+  }
+  if (target.rangeCenterAPV != -1) {
+    rangeCenterAPV = target.rangeCenterAPV;
   }
 
-  /* Save new settings to EEPROM */
+  return HITECD_OK;
+}
+
+/* Writes the registers that differ between `settings` and `reference`, but
+only those that require a reboot, or only those that don't. */
+int HitecDServo::writeDiffRegisters(
+  const HitecDSettings &settings,
+  const HitecDSettings &reference,
+  bool rebootRegisters,
+  bool *wroteOut
+) {
+  int res;
+  uint16_t ssConsts[4];
+  if (settings.smartSense != reference.smartSense) {
+    if ((res = readSmartSenseConstants(ssConsts)) != HITECD_OK) {
+      return res;
+    }
+  }
+
+  uint8_t regs[HD_SETTINGS_MAX_WRITES];
+  uint16_t vals[HD_SETTINGS_MAX_WRITES];
+  uint8_t n = hitecdDiffSettings(settings, reference, ssConsts, regs, vals);
+
+  *wroteOut = false;
+  for (uint8_t i = 0; i < n; ++i) {
+    if (requiresReboot(regs[i], vals[i], reference) == rebootRegisters) {
+      writeRawRegister(regs[i], vals[i]);
+      *wroteOut = true;
+    }
+  }
+  return HITECD_OK;
+}
+
+int HitecDServo::revertVolatile(const HitecDSettings &previous) {
+  /* `previous` came from this servo, so it's safe to write back. If reverting
+  means saving the servo, the temporary values of the settings that take effect
+  immediately mustn't be saved with it; the previous values should. */
+  return applyVolatile(previous, true, NULL, true);
+}
+
+int HitecDServo::beginSettingsSession(HitecDSettingsSession *_session) {
+  int res;
+
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (!isModelSupported()) {
+    return HITECD_ERR_UNSUPPORTED_MODEL;
+  }
+
+  if ((res = readSettings(&_session->saved)) != HITECD_OK) {
+    return res;
+  }
+  _session->staged = _session->saved;
+  session = _session;
+  return HITECD_OK;
+}
+
+int HitecDServo::stageSettings(const HitecDSettings &settings) {
+  int res;
+
+  if (!session) {
+    return HITECD_ERR_NO_SESSION;
+  }
+
+  HitecDSettings target = settings;
+  resolveDefaultRanges(&target, modelNumber);
+
+  /* The servo already has the previously-staged values of the settings that
+  take effect immediately. */
+  bool wrote;
+  if ((res = writeDiffRegisters(target, session->staged, false, &wrote)) !=
+      HITECD_OK) {
+    return res;
+  }
+  session->staged = target;
+  return HITECD_OK;
+}
+
+int HitecDServo::commitSettingsSession(uint8_t flags) {
+  int res;
+
+  if (!session) {
+    return HITECD_ERR_NO_SESSION;
+  }
+
+  bool changed = false;
+  HitecDSettingsCodec codec;
+  for (uint8_t i = 0; i < HD_NUM_SETTINGS_CODECS; ++i) {
+    hitecdGetSettingsCodec(i, &codec);
+    if (hitecdSettingDiffers(codec, session->staged, session->saved)) {
+      changed = true;
+    }
+  }
+  if (!changed) {
+    session = NULL;
+    return HITECD_OK;
+  }
+  if (saveBudgetExhausted()) {
+    return HITECD_ERR_SAVE_BUDGET;
+  }
+
+  bool reboot;
+  res = writeDiffRegisters(session->staged, session->saved, true, &reboot);
+  if (res != HITECD_OK) {
+    return res;
+  }
+
+  /* stageSettings() has already written the others, except that it holds back
+  a change to FAIL_SAFE that needs a reboot relative to what was staged before,
+  but might not relative to `saved`. Writing them again is harmless. */
+  bool wrote;
+  res = writeDiffRegisters(session->staged, session->saved, false, &wrote);
+  if (res != HITECD_OK) {
+    return res;
+  }
+  HitecDSettings &staged = session->staged;
+  if (staged.rangeLeftAPV != -1) {
+    rangeLeftAPV = staged.rangeLeftAPV;
+  }
+  if (staged.rangeRightAPV != -1) {
+    rangeRightAPV = staged.rangeRightAPV;
+  }
+  if (staged.rangeCenterAPV != -1) {
+    rangeCenterAPV = staged.rangeCenterAPV;
+  }
+  session = NULL;
+
   writeRawRegister(HD_REG_SAVE, HD_SAVE_CONST);
+  if (!reboot) {
+    return HITECD_OK;
+  }
+  writeRawRegister(HD_REG_REBOOT, HD_REBOOT_CONST);
+  if (flags & HITECD_WRITE_WAIT_UNTIL_READY) {
+    return waitUntilReady(HD_BOOT_TIMEOUT_MS);
+  }
+  return HITECD_OK_REBOOTING;
+}
 
-  /* Reboot the servo so the new settings take effect */
+int HitecDServo::abortSettingsSession() {
+  int res;
+
+  if (!session) {
+    return HITECD_ERR_NO_SESSION;
+  }
+
+  bool wrote;
+  res = writeDiffRegisters(session->saved, session->staged, false, &wrote);
+  session = NULL;
+  return res;
+}
+
+uint32_t HitecDServo::getSaveCount() {
+  return saveCount;
+}
+
+void HitecDServo::setSaveCount(uint32_t count) {
+  saveCount = count;
+}
+
+void HitecDServo::setSaveBudget(uint32_t budget) {
+  saveBudget = budget;
+}
+
+bool HitecDServo::saveBudgetExhausted() {
+  return saveBudget != 0 && saveCount >= saveBudget;
+}
+
+int HitecDServo::writeChangedSettings(
+  const HitecDSettings &settings,
+  const HitecDSettings &reference,
+  bool *changedOut,
+  bool *rebootOut
+) {
+  int res;
+  uint16_t ssConsts[4];
+  if (settings.smartSense != reference.smartSense) {
+    if ((res = readSmartSenseConstants(ssConsts)) != HITECD_OK) {
+      return res;
+    }
+  }
+
+  uint8_t regs[HD_SETTINGS_MAX_WRITES];
+  uint16_t vals[HD_SETTINGS_MAX_WRITES];
+  uint8_t n = hitecdDiffSettings(settings, reference, ssConsts, regs, vals);
+
+  *changedOut = *rebootOut = false;
+  for (uint8_t i = 0; i < n; ++i) {
+    writeSettingsRegister(regs[i], vals[i], reference, rebootOut);
+    *changedOut = true;
+  }
+  return HITECD_OK;
+}
+
+int HitecDServo::writeSettingsDelta(
+  const HitecDSettings &settings,
+  uint8_t flags
+) {
+  int res;
+
+  /* If a register cache is in use, this is answered from RAM. */
+  HitecDSettings current;
+  if ((res = readSettings(&current)) != HITECD_OK) {
+    return res;
+  }
+
+  /* A range of -1 means the factory default. If we don't know the factory
+  default for this model, leave the range alone. */
+  HitecDSettings target = settings;
+  resolveDefaultRanges(&target, modelNumber);
+
+  bool changed, reboot;
+  res = writeChangedSettings(target, current, &changed, &reboot);
+  if (res != HITECD_OK) {
+    return res;
+  }
+  if (target.rangeLeftAPV != -1) {
+    rangeLeftAPV = target.rangeLeftAPV;
+  }
+  if (target.rangeRightAPV != -1) {
+    rangeRightAPV = target.rangeRightAPV;
+  }
+  if (target.rangeCenterAPV != -1) {
+    rangeCenterAPV = target.rangeCenterAPV;
+  }
+  if (changed) {
+    target.rangeLeftAPV = rangeLeftAPV;
+    target.rangeRightAPV = rangeRightAPV;
+    target.rangeCenterAPV = rangeCenterAPV;
+    storeEEPROMSettings(target);
+  }
+
+  if (!changed) {
+    return HITECD_OK;
+  }
+
+  writeRawRegister(HD_REG_SAVE, HD_SAVE_CONST);
+  if (!reboot) {
+    return HITECD_OK;
+  }
   writeRawRegister(HD_REG_REBOOT, HD_REBOOT_CONST);
+  if (flags & HITECD_WRITE_WAIT_UNTIL_READY) {
+    return waitUntilReady(HD_BOOT_TIMEOUT_MS);
+  }
+  return HITECD_OK_REBOOTING;
+}
 
-  /* After writing to REBOOT, the servo will take 1000ms to boot. During this
-  time, it won't respond to commands. The caller is responsible for waiting
-  1000ms before trying to issue any commands. */
+static uint8_t *appendImageFrame(uint8_t *p, uint8_t reg, uint16_t val) {
+  uint8_t low = val & 0xFF;
+  uint8_t high = (val >> 8) & 0xFF;
+  *p++ = 0x96;
+  *p++ = 0x00;
+  *p++ = reg;
+  *p++ = 0x02;
+  *p++ = low;
+  *p++ = high;
+  *p++ = (0x00 + reg + 0x02 + low + high) & 0xFF;
+  return p;
+}
 
-  /* After 1000ms elapses, the HPC-11 writes 0x1000 to register 0x22. I'm not
-  sure what this is for; register 0x22 stores the calculated power limit (after
-  applying overload protection) and writing to it appears to have no effect.
-  This library doesn't write to register 0x22. */
+int HitecDServo::encodeSettingsImage(
+  const HitecDSettings &settings,
+  uint8_t *imageOut,
+  uint16_t maxLen
+) {
+  int res;
 
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (!isModelSupported()) {
+    return HITECD_ERR_UNSUPPORTED_MODEL;
+  }
+
+  /* This is the same sequence of writes that
+  writeSettingsUnsupportedModelThisMightDamageTheServo() does. */
+  HitecDSettings target = settings, defaults;
+  resolveDefaultRanges(&target, modelNumber);
+  resolveDefaultRanges(&defaults, modelNumber);
+  uint16_t ssConsts[4];
+  if ((res = readSmartSenseConstants(ssConsts)) != HITECD_OK) {
+    return res;
+  }
+  uint8_t regs[HD_SETTINGS_MAX_WRITES];
+  uint16_t vals[HD_SETTINGS_MAX_WRITES];
+  uint8_t n = hitecdDiffSettings(target, defaults, ssConsts, regs, vals);
+
+  uint16_t len = HITECD_IMAGE_HEADER_LEN + (n + 5) * HITECD_IMAGE_FRAME_LEN + 1;
+  if (len > maxLen) {
+    return HITECD_ERR_BAD_IMAGE;
+  }
+
+  const uint16_t header[4] = {
+    (uint16_t)modelNumber,
+    (uint16_t)target.rangeLeftAPV,
+    (uint16_t)target.rangeRightAPV,
+    (uint16_t)target.rangeCenterAPV
+  };
+  uint8_t *p = imageOut;
+  *p++ = HITECD_IMAGE_MAGIC;
+  for (uint8_t i = 0; i < 4; ++i) {
+    *p++ = header[i] & 0xFF;
+    *p++ = (header[i] >> 8) & 0xFF;
+  }
+  p = appendImageFrame(p, HD_REG_FACTORY_RESET, HD_FACTORY_RESET_CONST);
+  p = appendImageFrame(p, HD_REG_MYSTERY_OP1, HD_MYSTERY_OP1_CONST);
+  p = appendImageFrame(p, HD_REG_MYSTERY_OP2, HD_MYSTERY_OP2_CONST);
+  for (uint8_t i = 0; i < n; ++i) {
+    p = appendImageFrame(p, regs[i], vals[i]);
+  }
+  p = appendImageFrame(p, HD_REG_SAVE, HD_SAVE_CONST);
+  p = appendImageFrame(p, HD_REG_REBOOT, HD_REBOOT_CONST);
+  *p++ = HITECD_IMAGE_END;
+
+  return len;
+}
+
+int HitecDServo::applySettingsImage(const uint8_t *image, uint8_t flags) {
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+
+  /* encodeSettingsImage() only makes images for supported models, but an image
+  could also be written by hand. */
+  if (!isModelSupported()) {
+    return HITECD_ERR_UNSUPPORTED_MODEL;
+  }
+
+  if (saveBudgetExhausted()) {
+    return HITECD_ERR_SAVE_BUDGET;
+  }
+
+  if (pgm_read_byte(&image[0]) != HITECD_IMAGE_MAGIC) {
+    return HITECD_ERR_BAD_IMAGE;
+  }
+  if (pgm_read_word(&image[1]) != (uint16_t)modelNumber) {
+    return HITECD_ERR_WRONG_MODEL;
+  }
+
+  /* Check the whole image before sending any of it, so a bad image can't leave
+  the servo half-configured. */
+  const uint8_t *frames = image + HITECD_IMAGE_HEADER_LEN;
+  const uint8_t *p = frames;
+  while (pgm_read_byte(p) == 0x96) {
+    uint8_t sum = 0;
+    for (uint8_t i = 1; i < HITECD_IMAGE_FRAME_LEN - 1; ++i) {
+      sum += pgm_read_byte(&p[i]);
+    }
+    if (sum != pgm_read_byte(&p[HITECD_IMAGE_FRAME_LEN - 1])) {
+      return HITECD_ERR_BAD_IMAGE;
+    }
+    p += HITECD_IMAGE_FRAME_LEN;
+  }
+  if (pgm_read_byte(p) != HITECD_IMAGE_END) {
+    return HITECD_ERR_BAD_IMAGE;
+  }
+
+  invalidateEEPROMSettings();
+
+  uint8_t frame[HITECD_IMAGE_FRAME_LEN];
+  for (p = frames; pgm_read_byte(p) == 0x96; p += HITECD_IMAGE_FRAME_LEN) {
+    memcpy_P(frame, p, HITECD_IMAGE_FRAME_LEN);
+    writeFrame(frame, HITECD_IMAGE_FRAME_LEN);
+    if (!timerWriteFrame) {
+      delay(1);
+    }
+    if (registerCache) {
+      updateCacheAfterWrite(frame[2], frame[4] | (frame[5] << 8));
+    }
+    if (frame[2] == HD_REG_SAVE) {
+      ++saveCount;
+    }
+    trackUnsavedWrites(frame[2]);
+  }
+
+  /* Update the instance variables that we initialized in attach(). */
+  int16_t left = pgm_read_word(&image[3]);
+  int16_t right = pgm_read_word(&image[5]);
+  int16_t center = pgm_read_word(&image[7]);
+  if (left != -1 && right != -1 && center != -1) {
+    rangeLeftAPV = left;
+    rangeRightAPV = right;
+    rangeCenterAPV = center;
+  }
+
+  if (flags & HITECD_WRITE_WAIT_UNTIL_READY) {
+    return waitUntilReady(HD_BOOT_TIMEOUT_MS);
+  }
   return HITECD_OK;
 }
 
+int HitecDServo::waitUntilReady(unsigned long timeoutMillis) {
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (readState != HD_READ_IDLE) {
+    return HITECD_ERR_BUSY;
+  }
+
+  /* Finish sending anything the timer engine has queued (e.g. REBOOT). */
+  while (hitecdTimerBusy) { }
+
+  /* Release the line, like when reading a register. While the servo is
+  booting, it drives the line low; once it's ready, it lets the pullup
+  resistor pull the line high. */
+  pinMode(pin, INPUT_PULLUP);
+
+  unsigned long startMillis = millis();
+  int res = HITECD_ERR_BOOTING_OR_NO_PULLUP;
+
+  /* If we just wrote REBOOT, the servo may not have started booting yet, so
+  the line may still be high. Wait a little while for it to go low. If it
+  doesn't, the servo wasn't booting in the first place. */
+  bool sawLow = false;
+  while (millis() - startMillis < HD_BOOT_START_MS) {
+    if (digitalRead(pin) == LOW) {
+      sawLow = true;
+      break;
+    }
+  }
+
+  /* Wait for the line to stay high for READY_DEBOUNCE_US. The glitch about
+  1.6ms into the boot (see "Bootup behavior" in HitecDServoInternal.h) is only
+  a few microseconds long, so it won't be mistaken for the servo being ready. */
+  unsigned long highSinceMicros = micros();
+  bool high = false;
+  while (millis() - startMillis < timeoutMillis) {
+    if (digitalRead(pin) == HIGH) {
+      if (!high) {
+        high = true;
+        highSinceMicros = micros();
+      } else if (micros() - highSinceMicros >= HD_READY_DEBOUNCE_US) {
+        res = HITECD_OK;
+        break;
+      }
+    } else {
+      high = false;
+    }
+  }
+
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+
+  /* The servo might not accept a command right as it releases the line; give
+  it the same gap as between any two commands. */
+  if (res == HITECD_OK && sawLow) {
+    delay(1);
+  }
+  return res;
+}
+
 int HitecDServo::readRawRegister(uint8_t reg, uint16_t *valOut) {
-  uint8_t oldSREG = SREG;
-  cli();
+  int8_t index = cacheIndex(reg);
+  if (index >= 0 && attached() && (registerCache->valid & (1UL << index))) {
+    *valOut = registerCache->values[index];
+    return HITECD_OK;
+  }
+
+  int res;
+  if ((res = beginReadRawRegister(reg)) != HITECD_OK) {
+    return res;
+  }
+  while ((res = pollReadRawRegister(valOut)) == HITECD_PENDING) { }
+  return res;
+}
+
+int HitecDServo::readRawRegisters(
+  const uint8_t *regs,
+  uint8_t n,
+  uint16_t *valsOut,
+  int *resultsOut
+) {
+  int firstErr = HITECD_OK;
+  for (uint8_t i = 0; i < n; ++i) {
+    /* The next request follows right away, so only the last read needs the
+    full cooldown. */
+    if (i + 1 < n) {
+      readCooldownMicros = HD_READ_BATCH_GAP_US;
+    }
+    int res = readRawRegister(regs[i], &valsOut[i]);
+    readCooldownMicros = HD_READ_COOLDOWN_US;
+
+    if (resultsOut) {
+      resultsOut[i] = res;
+    }
+    if (res == HITECD_ERR_NOT_ATTACHED || res == HITECD_ERR_BUSY) {
+      /* None of the other reads will work either */
+      for (uint8_t j = i + 1; resultsOut && j < n; ++j) {
+        resultsOut[j] = res;
+      }
+      return res;
+    }
+    if (res != HITECD_OK && firstErr == HITECD_OK) {
+      firstErr = res;
+    }
+  }
+  return firstErr;
+}
+
+int HitecDServo::beginReadRawRegister(uint8_t reg) {
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (readState != HD_READ_IDLE) {
+    return HITECD_ERR_BUSY;
+  }
 
-  writeByte((uint8_t)0x96);
-  writeByte((uint8_t)0x00);
-  writeByte(reg);
-  writeByte((uint8_t)0x00);
   uint8_t checksum = (0x00 + reg + 0x00) & 0xFF;
-  writeByte(checksum);
-  digitalWrite(pin, LOW);
+  uint8_t frame[5] = {0x96, 0x00, reg, 0x00, checksum};
+  writeFrame(frame, sizeof(frame));
+
+  /* The servo's response timing is measured from the end of our transmission,
+  so if the timer is sending the frame, wait for it to finish. */
+  while (hitecdTimerBusy) { }
+  readStartMicros = micros();
+  readReg = reg;
+  readState = HD_READ_WAIT_RELEASE;
+  return HITECD_OK;
+}
 
-  SREG = oldSREG;
+int HitecDServo::pollReadRawRegister(uint16_t *valOut) {
+  unsigned long elapsed = micros() - readStartMicros;
 
-  delay(14);
+  switch (readState) {
+  case HD_READ_IDLE:
+    /* beginReadRawRegister() wasn't called */
+    return attached() ? HITECD_ERR_CONFUSED : HITECD_ERR_NOT_ATTACHED;
 
-  /* Note, most of the pull-up current must actually provided by an external
-  resistor; the microcontroller pullup by itself is nowhere near strong enough.
-  We use INPUT_PULLUP anyway because that lets us detect the absence of a servo
-  even if the pullup resistor is also absent. */
-  pinMode(pin, INPUT_PULLUP);
+  case HD_READ_WAIT_RELEASE:
+    if (elapsed < HD_READ_RELEASE_US) {
+      return HITECD_PENDING;
+    }
+
+    /* Note, most of the pull-up current must actually provided by an external
+    resistor; the microcontroller pullup by itself is nowhere near strong
+    enough. We use INPUT_PULLUP anyway because that lets us detect the absence
+    of a servo even if the pullup resistor is also absent. */
+    pinMode(pin, INPUT_PULLUP);
+
+    /* At this point, the servo should be pulling the pin low. If the pin goes
+    high when we release the line, then no servo is connected. */
+    if (digitalRead(pin) != LOW) {
+      pinMode(pin, OUTPUT);
+      digitalWrite(pin, LOW);
+      readResult = HITECD_ERR_NO_SERVO;
+      readDeadlineMicros = micros() + readCooldownMicros;
+      readState = HD_READ_COOLDOWN;
+      return HITECD_PENDING;
+    }
+
+    readState = HD_READ_WAIT_RESPONSE;
+    /* fall through */
+
+  case HD_READ_WAIT_RESPONSE:
+    if (elapsed > responseWindowStart() + responseWindowLength() / 2) {
+      /* We got here too late; the servo has already started responding. Wait
+      for the response to be over before releasing the line. */
+      readResult = HITECD_ERR_MISSED_RESPONSE;
+      readDeadlineMicros = readStartMicros + HD_READ_RESPONSE_US +
+        HD_READ_RESPONSE_LEN_US + 1000;
+      readState = HD_READ_WAIT_RELEASED;
+      return HITECD_PENDING;
+    }
+
+    if (timerReceiver) {
+      timerReceiver->start(pin, 7);
+      readState = HD_READ_RECEIVING;
+      return HITECD_PENDING;
+    }
+
+    /* Keep interrupts enabled until shortly before the response is due. The
+    caller polls at least once per millisecond, so only start waiting here if
+    the next poll might come too late. */
+    if (elapsed + HD_READ_POLL_INTERVAL_US < responseWindowStart()) {
+      return HITECD_PENDING;
+    }
+    while (micros() - readStartMicros < responseWindowStart()) { }
+    {
+      uint8_t response[7];
+      unsigned long startBitMicros;
+      readResult = receiveResponse(response, &startBitMicros);
+      if (readResult == HITECD_OK) {
+        readResult = parseResponse(response);
+      }
+      if (readResult == HITECD_OK) {
+        recordLatency(startBitMicros - readStartMicros);
+      }
+    }
+    readDeadlineMicros = micros() + HD_READ_RELEASED_CHECK_US;
+    readState = HD_READ_WAIT_RELEASED;
+    return HITECD_PENDING;
+
+  case HD_READ_RECEIVING:
+    if (hitecdTimerRxCount == 7) {
+      readResult = parseResponse(hitecdTimerRxBuffer);
+    } else if (elapsed > responseWindowStart() + responseWindowLength() +
+        HD_READ_RESPONSE_LEN_US) {
+      timerReceiver->stop();
+      readResult = HITECD_ERR_CORRUPT;
+    } else {
+      return HITECD_PENDING;
+    }
+    readDeadlineMicros = micros() + HD_READ_RELEASED_CHECK_US;
+    readState = HD_READ_WAIT_RELEASED;
+    return HITECD_PENDING;
+
+  case HD_READ_WAIT_RELEASED:
+    if ((long)(micros() - readDeadlineMicros) < 0) {
+      return HITECD_PENDING;
+    }
+
+    /* At this point, the servo should have released the line, allowing the
+    pullup resistor to pull it high. Give it up to READ_RELEASED_TIMEOUT_US to
+    do so. If the pin still isn't high, there are two possible reasons this
+    could happen:
+    1. The servo is booting. This takes 1 second from when the servo first
+       receives power, or is reset via register 0x46. During this time, it will
+       pull the line low and not respond to commands.
+    2. The pullup resistor is missing. */
+    if (digitalRead(pin) != HIGH) {
+      if (micros() - readDeadlineMicros < HD_READ_RELEASED_TIMEOUT_US) {
+        return HITECD_PENDING;
+      }
+      readResult = HITECD_ERR_BOOTING_OR_NO_PULLUP;
+    }
 
-  /* At this point, the servo should be pulling the pin low. If the pin goes
-  high when we release the line, then no servo is connected. */
-  if (digitalRead(pin) != LOW) {
-    delay(2);
     pinMode(pin, OUTPUT);
-    return HITECD_ERR_NO_SERVO;
+    digitalWrite(pin, LOW);
+    readDeadlineMicros = micros() + readCooldownMicros;
+    readState = HD_READ_COOLDOWN;
+    return HITECD_PENDING;
+
+  case HD_READ_COOLDOWN:
+    if ((long)(micros() - readDeadlineMicros) < 0) {
+      return HITECD_PENDING;
+    }
+    readState = HD_READ_IDLE;
+    if (readResult == HITECD_OK) {
+      *valOut = readValue;
+      int8_t index = cacheIndex(readReg);
+      if (index >= 0 && !(registerCache->dirty & (1UL << index))) {
+        registerCache->values[index] = readValue;
+        registerCache->valid |= 1UL << index;
+      }
+    }
+    return readResult;
   }
 
-  oldSREG = SREG;
+  return HITECD_ERR_CONFUSED;
+}
+
+int HitecDServo::receiveResponse(
+  uint8_t *response,
+  unsigned long *startBitMicrosOut
+) {
+  int bytes[7];
+
+  /* The first byte has to wait out the rest of the response window; the rest
+  follow right after each other. The next start bit can come half a bit after
+  readByte() samples the stop bit, so there's no time to convert timeouts (or
+  call micros()) between bytes; do it all up front. */
+  uint8_t loopCycles = readByteLoopCycles();
+  uint32_t windowLoops = hitecdTimeoutLoops(responseWindowLength(), loopCycles);
+  uint32_t gapLoops = hitecdTimeoutLoops(HD_READ_BYTE_GAP_TIMEOUT_US,
+    loopCycles);
+  uint32_t loops = windowLoops;
+
+  uint8_t oldSREG = SREG;
+  unsigned long windowStartMicros = micros();
   cli();
 
-  int const0x69 = readByte();
-  int mystery = readByte(); /* I don't know what this byte is for... */
-  int reg2 = readByte();
-  int const0x02 = readByte();
-  int low = readByte();
-  int high = readByte();
-  int checksum2 = readByte();
+  bytes[0] = readByte(&loops);
+  uint32_t firstByteLoops = windowLoops - loops;
 
-  SREG = oldSREG;
-  
-  delay(1);
-
-  /* At this point, the servo should have released the line, allowing the
-  pullup resistor to pull it high. If the pin is not high, there are two
-  possible reasons this could happen:
-  1. The servo is booting. This takes 1 second from when the servo first
-     receives power, or is reset via register 0x46. During this time, it will
-     pull the line low and not respond to commands.
-  2. The pullup resistor is missing. */
-  if (digitalRead(pin) != HIGH) {
-    pinMode(pin, OUTPUT);
-    digitalWrite(pin, LOW);
-    return HITECD_ERR_BOOTING_OR_NO_PULLUP;
+  for (uint8_t i = 1; i < 7; ++i) {
+    if (bytes[i - 1] < 0) {
+      bytes[i] = HITECD_ERR_CORRUPT;
+    } else {
+      loops = gapLoops;
+      bytes[i] = readByte(&loops);
+    }
   }
 
-  pinMode(pin, OUTPUT);
-  digitalWrite(pin, LOW);
-  delay(1);
+  SREG = oldSREG;
+
+  /* The first start bit arrived during polling loop `firstByteLoops` */
+  *startBitMicrosOut = windowStartMicros +
+    firstByteLoops * loopCycles / (F_CPU / 1000000L);
 
   /* Note, readByte() can return HITECD_ERR_NO_SERVO if it times out. But, we
-  know the servo is present, or else we'd have hit either HITECD_ERR_NO_SERVO or
-  HITECD_ERR_BOOTING_OR_NO_PULLUP above. So this is unlikely to happen unless
-  something's horribly wrong. So for simplicity, we just round this off to
-  HITECD_ERR_CORRUPT. */
+  know the servo is present, or else we'd have hit HITECD_ERR_NO_SERVO when we
+  released the line. So this is unlikely to happen unless something's horribly
+  wrong. So for simplicity, we just round this off to HITECD_ERR_CORRUPT. */
+  for (uint8_t i = 0; i < 7; ++i) {
+    if (bytes[i] < 0) return HITECD_ERR_CORRUPT;
+    response[i] = bytes[i];
+  }
+  return HITECD_OK;
+}
+
+/* Until we've measured the servo's response latency, we listen from
+READ_RESPONSE_GUARD_US before READ_RESPONSE_US, until the same amount after.
+Once we've measured it, we listen from READ_CALIBRATED_GUARD_US before the
+earliest response we've seen, until the same amount after the latest. */
+unsigned long HitecDServo::responseWindowStart() {
+  if (latencyStats.samples == 0) {
+    return HD_READ_RESPONSE_US - HD_READ_RESPONSE_GUARD_US;
+  }
+  return latencyStats.minMicros - HD_READ_CALIBRATED_GUARD_US;
+}
+
+unsigned long HitecDServo::responseWindowLength() {
+  if (latencyStats.samples == 0) {
+    return 2 * HD_READ_RESPONSE_GUARD_US;
+  }
+  return latencyStats.maxMicros - latencyStats.minMicros +
+    2 * HD_READ_CALIBRATED_GUARD_US;
+}
+
+void HitecDServo::recordLatency(unsigned long latencyMicros) {
+  /* Ignore measurements that are way off; they'd widen the window for every
+  subsequent read. */
+  if (latencyMicros < HD_READ_RESPONSE_US - HD_READ_RESPONSE_GUARD_US ||
+      latencyMicros > HD_READ_RESPONSE_US + HD_READ_RESPONSE_GUARD_US) {
+    return;
+  }
+  latencyStats.lastMicros = latencyMicros;
+  if (latencyStats.samples == 0 || latencyMicros < latencyStats.minMicros) {
+    latencyStats.minMicros = latencyMicros;
+  }
+  if (latencyStats.samples == 0 || latencyMicros > latencyStats.maxMicros) {
+    latencyStats.maxMicros = latencyMicros;
+  }
+  if (latencyStats.samples != 0xFFFF) {
+    ++latencyStats.samples;
+  }
+}
+
+void HitecDServo::getLatencyStats(HitecDLatencyStats *statsOut) {
+  *statsOut = latencyStats;
+}
+
+int HitecDServo::parseResponse(const uint8_t *response) {
+  uint8_t const0x69 = response[0];
+  uint8_t mystery = response[1]; /* I don't know what this byte is for... */
+  uint8_t reg2 = response[2];
+  uint8_t const0x02 = response[3];
+  uint8_t low = response[4];
+  uint8_t high = response[5];
+  uint8_t checksum2 = response[6];
 
   if (const0x69 != 0x69) return HITECD_ERR_CORRUPT;
-  if (mystery < 0) return HITECD_ERR_CORRUPT;
-  if (reg2 != reg) return HITECD_ERR_CORRUPT;
+  if (reg2 != readReg) return HITECD_ERR_CORRUPT;
   if (const0x02 != 0x02) return HITECD_ERR_CORRUPT;
-  if (low < 0) return HITECD_ERR_CORRUPT;
-  if (high < 0) return HITECD_ERR_CORRUPT;
   if (checksum2 != ((mystery + reg2 + const0x02 + low + high) & 0xFF)) {
     return HITECD_ERR_CORRUPT;
   }
 
-  *valOut = low + (high << 8);
+  readValue = low + (high << 8);
   return HITECD_OK;
 }
 
-void HitecDServo::writeRawRegister(uint8_t reg, uint16_t val) {
-  uint8_t oldSREG = SREG;
-  cli();
+/* SAVE makes the servo's EEPROM match its SRAM, and so does REBOOT, by
+discarding anything unsaved. Any other write except TARGET might leave them
+different. */
+void HitecDServo::trackUnsavedWrites(uint8_t reg) {
+  if (reg == HD_REG_SAVE || reg == HD_REG_REBOOT) {
+    unsavedWrites = false;
+  } else if (reg != HD_REG_TARGET) {
+    unsavedWrites = true;
+  }
+}
 
-  writeByte((uint8_t)0x96);
-  writeByte((uint8_t)0x00);
-  writeByte(reg);
-  writeByte((uint8_t)0x02);
+void HitecDServo::writeRawRegister(uint8_t reg, uint16_t val) {
   uint8_t low = val & 0xFF;
-  writeByte(low);
   uint8_t high = (val >> 8) & 0xFF;
-  writeByte(high);
   uint8_t checksum = (0x00 + reg + 0x02 + low + high) & 0xFF;
-  writeByte(checksum);
+  uint8_t frame[7] = {0x96, 0x00, reg, 0x02, low, high, checksum};
+  writeFrame(frame, sizeof(frame));
 
-  SREG = oldSREG;
+  /* The timer engine leaves the gap between frames by itself. */
+  if (!timerWriteFrame) {
+    delay(1);
+  }
 
-  digitalWrite(pin, LOW);
-  delay(1);
-}
+  if (registerCache) {
+    updateCacheAfterWrite(reg, val);
+  }
 
-#ifdef ARDUINO_ARCH_AVR
+  if (reg == HD_REG_SAVE) {
+    ++saveCount;
+  }
+  trackUnsavedWrites(reg);
 
-/* We're bit-banging a 115200 baud serial connection, so we need precise timing.
-The AVR libraries have a macro _delay_us() that delays a precise number of
-microseconds, using compile-time floating-point math. However, we also need to
-compensate for the time spent executing non-noop instructions, which depends on
-the CPU frequency. DELAY_US_COMPENSATED(us, cycles) will delay for an amount of
-time such that if 'cycles' non-noop instruction cycles are executed, the total
-time elapsed will be 'us'. */
-#define DELAY_US_COMPENSATED(us, cycles) _delay_us((us) - (cycles)/(F_CPU/1e6))
+  /* Any write other than these might change the settings. */
+  if (eepromValid && reg != HD_REG_TARGET && reg != HD_REG_SAVE &&
+      reg != HD_REG_REBOOT) {
+    invalidateEEPROMSettings();
+  }
+}
+
+/* The registers that the register cache covers. The first
+HD_CACHE_NUM_CONSTANT_REGS never change; the rest are settings, which only
+change when we write them. */
+#define HD_CACHE_NUM_CONSTANT_REGS 5
+static const uint8_t cachedRegisters[HITECD_CACHE_NUM_REGS] PROGMEM = {
+  HD_REG_MODEL_NUMBER,
+  HD_REG_SS_ENABLE_1,
+  HD_REG_SS_ENABLE_2,
+  HD_REG_SS_DISABLE_1,
+  HD_REG_SS_DISABLE_2,
+
+  HD_REG_ID,
+  HD_REG_DIRECTION,
+  HD_REG_SPEED,
+  HD_REG_DEADBAND_1,
+  HD_REG_DEADBAND_2,
+  HD_REG_DEADBAND_3,
+  HD_REG_SOFT_START,
+  HD_REG_RANGE_LEFT_APV,
+  HD_REG_RANGE_RIGHT_APV,
+  HD_REG_RANGE_CENTER_APV,
+  HD_REG_FAIL_SAFE,
+  HD_REG_POWER_LIMIT,
+  HD_REG_OVERLOAD_PROTECTION,
+  HD_REG_SMART_SENSE_1,
+  HD_REG_SMART_SENSE_2,
+  HD_REG_SENSITIVITY_RATIO
+};
+
+/* Bits of the registers that get reset by FACTORY_RESET */
+#define HD_CACHE_SETTINGS_MASK \
+  (((1UL << HITECD_CACHE_NUM_REGS) - 1) & \
+    ~((1UL << HD_CACHE_NUM_CONSTANT_REGS) - 1))
+
+void HitecDServo::useRegisterCache(HitecDRegisterCache *cache) {
+  registerCache = cache;
+  if (registerCache) {
+    registerCache->valid = 0;
+    registerCache->dirty = 0;
+    registerCache->unsaved = 0;
+  }
+}
 
-int HitecDServo::readByte() {
-  /* Wait up to 50ms for start bit. The "/ 10" factor arises because this loop
-  empirically takes somewhere on the order of 10 clock cycles per iteration.
-  In theory we should only need to wait up to about 10ms, but the number of
-  clock-cycles-per-iteration is very imprecise and depends on the compiler, so
-  we add a lot of padding.
-  TODO: It would be better to write this logic in assembler so we can control
-  exactly how many clock cycles it takes. */
-  uint32_t timeoutCounter = F_CPU * 0.050 / 10;
-  while (!(*pinInputRegister & pinBitMask)) {
-    if (--timeoutCounter == 0) {
-      return HITECD_ERR_NO_SERVO;
+int8_t HitecDServo::cacheIndex(uint8_t reg) {
+  if (!registerCache) {
+    return -1;
+  }
+  for (int8_t i = 0; i < HITECD_CACHE_NUM_REGS; ++i) {
+    if (pgm_read_byte(&cachedRegisters[i]) == reg) {
+      return i;
     }
   }
+  return -1;
+}
 
-  /* Delay until approximate center of first data bit. */
-  DELAY_US_COMPENSATED(8.68*1.5, 32);
+void HitecDServo::updateCacheAfterWrite(uint8_t reg, uint16_t val) {
+  /* TARGET is never cached, and it's written at up to hundreds of Hz (e.g. by
+  HitecDServoTrajectory), so skip the table scan. */
+  if (reg == HD_REG_TARGET) {
+    return;
+  }
+  int8_t index = cacheIndex(reg);
+  if (index >= 0) {
+    uint32_t bit = 1UL << index;
+    registerCache->values[index] = val;
+    registerCache->valid |= bit;
+    registerCache->dirty &= ~bit;
+    registerCache->unsaved |= bit;
+  } else if (reg == HD_REG_SAVE) {
+    registerCache->unsaved = 0;
+  } else if (reg == HD_REG_REBOOT) {
+    /* Registers that were written but not saved revert to their saved values.
+    (Dirty registers haven't been written yet, so they keep their pending
+    values.) */
+    registerCache->valid &= ~registerCache->unsaved | registerCache->dirty;
+    registerCache->unsaved = 0;
+  } else if (reg == HD_REG_FACTORY_RESET) {
+    registerCache->valid &= ~HD_CACHE_SETTINGS_MASK | registerCache->dirty;
+  }
+}
 
-  /* Read data bits */
-  uint8_t val = 0;
-  for (int m = 0x001; m != 0x100; m <<= 1) {
-    if(!(*pinInputRegister & pinBitMask)) {
-      val |= m;
-    }
-    DELAY_US_COMPENSATED(8.68, 19);
+void HitecDServo::writeCachedRegister(uint8_t reg, uint16_t val) {
+  int8_t index = cacheIndex(reg);
+  if (index < 0) {
+    writeRawRegister(reg, val);
+    return;
+  }
+  uint32_t bit = 1UL << index;
+  if ((registerCache->valid & bit) && registerCache->values[index] == val) {
+    return;
   }
+  registerCache->values[index] = val;
+  registerCache->valid |= bit;
+  registerCache->dirty |= bit;
+  invalidateEEPROMSettings();
+}
 
-  /* We expect to see stop bit (low) */
-  if (*pinInputRegister & pinBitMask) {
-    return HITECD_ERR_CORRUPT;
+void HitecDServo::flushRegisterCache() {
+  if (!registerCache) {
+    return;
   }
+  for (int8_t i = 0; i < HITECD_CACHE_NUM_REGS; ++i) {
+    if (registerCache->dirty & (1UL << i)) {
+      writeRawRegister(pgm_read_byte(&cachedRegisters[i]),
+        registerCache->values[i]);
+    }
+  }
+}
 
-  return val;
+bool HitecDServo::transmitDone() {
+  return !hitecdTimerBusy;
 }
 
-void HitecDServo::writeByte(uint8_t val) {
-  /* Write start bit. Note polarity is inverted, so start bit is HIGH. */
-  *pinOutputRegister |= pinBitMask;
+void HitecDServo::writeFrame(const uint8_t *frame, uint8_t len) {
+  if (timerWriteFrame) {
+    timerWriteFrame(pinOutputRegister, pinBitMask, frame, len);
+    return;
+  }
 
-  /* We're operating at 115200 baud, so theoretically there should be an 8.68us
-  interval between edges. In practice, this loop seems to take about 25 clock
-  cycles per iteration, so compensate for that. */
-  DELAY_US_COMPENSATED(8.68, 25);
+  /* Don't interfere with a frame that the timer is still sending (e.g. for
+  another servo). */
+  while (hitecdTimerBusy) { }
 
-  for (int m = 0x001; m != 0x100; m <<= 1) {
-    if (val & m) {
-      *pinOutputRegister &= ~pinBitMask;
-    } else {
-      *pinOutputRegister |= pinBitMask;
-    }
-    DELAY_US_COMPENSATED(8.68, 25);
+  uint8_t oldSREG = SREG;
+  cli();
+
+  for (uint8_t i = 0; i < len; ++i) {
+    writeByte(frame[i]);
   }
 
-  /* Write stop bit. */
-  *pinOutputRegister &= ~pinBitMask;
-  DELAY_US_COMPENSATED(8.68, 25);
+  SREG = oldSREG;
+
+  digitalWrite(pin, LOW);
+}
+
+#ifdef ARDUINO_ARCH_AVR
+
+int HitecDServo::readByte(uint32_t *timeoutLoops) {
+  /* The bit engine counts the cycles of its polling loop exactly, so the
+  timeout is exact too. */
+  return hitecdReadByteExact(pinInputRegister, pinBitMask, timeoutLoops);
+}
+
+uint8_t HitecDServo::readByteLoopCycles() {
+  return HD_WAIT_LOOP_CYCLES;
+}
+
+void HitecDServo::writeByte(uint8_t val) {
+  /* Interrupts are disabled, so nothing else will touch the port while we're
+  writing; we can compute both levels of the port once, up front. */
+  uint8_t high = *pinOutputRegister | pinBitMask;
+  uint8_t low = *pinOutputRegister & ~pinBitMask;
+  hitecdWriteByteExact(pinOutputRegister, high, low, val);
 }
 
 #else
@@ -657,32 +1726,35 @@ HitecDSettings::HitecDSettings() :
 { }
 
 int16_t HitecDSettings::defaultRangeLeftAPV(int modelNumber) {
-  switch (modelNumber) {
-    case HD_MODEL_NUMBER_D485HW: return 3381;
-    default: return -1;
+  HitecDModelProfile profile;
+  if (!hitecdFindModelProfile(modelNumber, &profile)) {
+    return -1;
   }
+  return profile.defaultRangeLeftAPV;
 }
 
 int16_t HitecDSettings::defaultRangeRightAPV(int modelNumber) {
-  switch (modelNumber) {
-    case HD_MODEL_NUMBER_D485HW: return 13002;
-    default: return -1;
+  HitecDModelProfile profile;
+  if (!hitecdFindModelProfile(modelNumber, &profile)) {
+    return -1;
   }
+  return profile.defaultRangeRightAPV;
 }
 
 int16_t HitecDSettings::defaultRangeCenterAPV(int modelNumber) {
-  switch (modelNumber) {
-    case HD_MODEL_NUMBER_D485HW: return 8192;
-    default: return -1;
+  HitecDModelProfile profile;
+  if (!hitecdFindModelProfile(modelNumber, &profile)) {
+    return -1;
   }
+  return profile.defaultRangeCenterAPV;
 }
 
 int16_t HitecDSettings::widestRangeLeftAPV(int modelNumber) {
-  switch (modelNumber) {
-    /* I measured 731, and added +50 as a margin of error */
-    case HD_MODEL_NUMBER_D485HW: return 731 + 50;
-    default: return -1;
+  HitecDModelProfile profile;
+  if (!hitecdFindModelProfile(modelNumber, &profile)) {
+    return -1;
   }
+  return profile.widestRangeLeftAPV;
 }
 
 int16_t HitecDSettings::widestRangeRightAPV(int modelNumber) {
@@ -720,6 +1792,32 @@ const __FlashStringHelper *hitecdErrToString(int err) {
       return F("Unsupported model of servo.");
     case HITECD_ERR_CONFUSED:
       return F("Confusing response from servo.");
+    case HITECD_ERR_BUSY:
+      return F("A non-blocking read is already in progress.");
+    case HITECD_ERR_MISSED_RESPONSE:
+      return F("pollReadRawRegister() wasn't called often enough, so the "
+        "servo's response was missed.");
+    case HITECD_ERR_NO_TIMER:
+      return F("The interrupt-driven engine isn't available on this board or "
+        "clock speed.");
+    case HITECD_ERR_WRONG_PORT:
+      return F("All the servos in a HitecDServoGroup must be on pins of the "
+        "same port.");
+    case HITECD_ERR_GROUP_FULL:
+      return F("A HitecDServoGroup or HitecDServoScheduler can't have more "
+        "than 8 servos.");
+    case HITECD_ERR_WRONG_MODEL:
+      return F("The settings image is for a different model of servo.");
+    case HITECD_ERR_BAD_IMAGE:
+      return F("The settings image is malformed or too big.");
+    case HITECD_ERR_SAVE_BUDGET:
+      return F("The servo's budget of EEPROM saves has been used up.");
+    case HITECD_ERR_NO_SESSION:
+      return F("beginSettingsSession() was not called.");
+    case HITECD_ERR_MOVE_TIMEOUT:
+      return F("The servo did not finish moving in time.");
+    case HITECD_ERR_SAME_PIN:
+      return F("A HitecDServoGroup already has a servo on that pin.");
     default:
       return F("Unknown error.");
   }
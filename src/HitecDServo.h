@@ -4,6 +4,40 @@
 #include <Arduino.h>
 
 class HitecDSettings;
+struct HitecDSettingsSession;
+struct HitecDTelemetry;
+struct HitecDTimerReceiver;
+
+/* The servo responds to a register read about 15.2ms after the request. The
+exact delay differs a little from servo to servo, so HitecDServo measures it on
+every read, starting in attach(), and listens for the response only in a narrow
+window around the delays it has seen. HitecDLatencyStats reports the
+measurements, e.g. to spot a servo whose timing is drifting. All times are in
+microseconds, from the end of the request to the start of the response. */
+struct HitecDLatencyStats {
+  uint16_t lastMicros;
+  uint16_t minMicros;
+  uint16_t maxMicros;
+  /* Number of measurements since attach(); if zero, the other fields are
+  meaningless. */
+  uint16_t samples;
+};
+
+/* The number of registers covered by HitecDRegisterCache: the settings
+registers, plus some registers that never change. The MYSTERY_* registers
+that the DPC-11 writes along with some settings aren't cached, since they don't
+necessarily read back what was written, and must be written every time. */
+#define HITECD_CACHE_NUM_REGS 21
+
+/* Bytes of EEPROM used per servo by useSettingsEEPROM() */
+#define HITECD_EEPROM_SLOT_LEN 32
+
+/* Storage for HitecDServo's optional register cache; see
+HitecDServo::useRegisterCache(). The fields are managed by HitecDServo. */
+struct HitecDRegisterCache {
+  uint16_t values[HITECD_CACHE_NUM_REGS];
+  uint32_t valid, dirty, unsaved;
+};
 
 class HitecDServo {
 public:
@@ -38,6 +72,43 @@ public:
   int16_t readCurrentQuarterMicros();
   int16_t readCurrentAPV();
 
+  /* Reads a snapshot of the servo's live state: position, velocity, motor
+  power, and so on (see HitecDTelemetry). The second form only reads the fields
+  selected by `fieldMask` (a combination of HITECD_TELEMETRY_* flags; see
+  below), and leaves the others alone. The registers are read in one batch, like
+  readRawRegisters(), so each field costs about 16ms. Returns HITECD_OK if all
+  the reads succeeded, or else the first error; the fields that were read
+  successfully are still filled in (see HitecDTelemetry::validMask). */
+  int readTelemetry(HitecDTelemetry *telemetryOut);
+  int readTelemetry(HitecDTelemetry *telemetryOut, uint8_t fieldMask);
+
+  /* Detect when the servo has finished moving, using its VELOCITY and
+  TRACKING_ERROR registers (see HitecDTelemetry), rather than by waiting for
+  its position to stop changing. The servo counts as settled when
+  abs(velocity) <= maxVelocity and abs(trackingError) <= maxTrackingError, for
+  `settledReads` checks in a row. If `maxTrackingError` is negative, the
+  tracking error isn't checked, so each check is a single read; use this when
+  the servo might not be able to reach its target, e.g. because it's pushing
+  against an obstacle. (Then settledReads=3 or so avoids mistaking the start of
+  the move for the end.) The defaults are HITECD_MOVE_DEFAULT_MAX_VELOCITY,
+  HITECD_MOVE_DEFAULT_MAX_TRACKING_ERROR, and 1.
+
+  isMoving() makes one check, and returns 1 if the servo is moving, 0 if it's
+  settled, or an error code. waitForMoveComplete() checks repeatedly until the
+  servo has settled, and returns HITECD_OK, or HITECD_ERR_MOVE_TIMEOUT if it
+  didn't settle within `timeoutMillis`, or another error code. The
+  non-blocking form works like beginReadRawRegister(): call
+  beginWaitForMoveComplete(), and then call pollWaitForMoveComplete() at least
+  once per millisecond until it returns something other than HITECD_PENDING.
+  Call these right after writing the target; a check takes about 16ms (or 32ms
+  with the tracking error). */
+  void setMoveCompleteThresholds(int16_t maxVelocity, int16_t maxTrackingError,
+    uint8_t settledReads = 1);
+  int isMoving();
+  int waitForMoveComplete(unsigned long timeoutMillis);
+  int beginWaitForMoveComplete(unsigned long timeoutMillis);
+  int pollWaitForMoveComplete();
+
   /* Returns the servo's model number, e.g. 485 for a D485HW model. */
   int readModelNumber();
 
@@ -45,17 +116,30 @@ public:
   version of the HitecDServo library. */
   bool isModelSupported();
 
-  /* Retrieves the current settings from the servo. */
+  /* Retrieves the current settings from the servo. The second form only reads
+  the fields selected by `fieldMask` (a combination of HITECD_FIELD_* flags; see
+  below), and leaves the other fields of *settingsOut alone. For example,
+  HITECD_FIELD_COUNTERCLOCKWISE | HITECD_FIELD_RANGE takes 4 register reads,
+  while all fields take 14, or 18 if the model isn't in the model table
+  (HITECD_FIELD_SMART_SENSE then also reads the four SS_* registers). The
+  registers are read in one batch (see readRawRegisters()), and the SS_*
+  registers, when needed, in a second one. */
   int readSettings(HitecDSettings *settingsOut);
+  int readSettings(HitecDSettings *settingsOut, uint16_t fieldMask);
 
   /* Resets the servo to its factory-default settings, then uploads the given
   settings, and reboots the servo. The servo will not respond to any commands
   for 1000ms after rebooting; so after writeSettings() returns, make sure to
-  wait 1000ms before trying to do anything else with the servo.
+  wait 1000ms before trying to do anything else with the servo. (Or pass
+  HITECD_WRITE_WAIT_UNTIL_READY, and writeSettings() will wait until the servo
+  has actually finished rebooting.)
 
   Note: Right now, this only works for the D485HW model. Other models
-  will return an error. */
-  int writeSettings(const HitecDSettings &settings);
+  will return an error.
+
+  `flags` is a combination of HITECD_WRITE_DELTA and
+  HITECD_WRITE_WAIT_UNTIL_READY (see below), or 0. */
+  int writeSettings(const HitecDSettings &settings, uint8_t flags = 0);
 
   /* It's dangerous to change the settings of a non-D485HW model; this hasn't
   been tested, and might damage the servo. If you're willing to take the risk,
@@ -63,7 +147,97 @@ public:
   allowUnsupportedModel=true to skip checking the servo model. */
   int writeSettingsUnsupportedModelThisMightDamageTheServo(
     const HitecDSettings &settings,
-    bool allowUnsupportedModel);
+    bool allowUnsupportedModel,
+    uint8_t flags = 0);
+
+  /* Changes the servo's settings without saving them, for example to change
+  the speed or power limit temporarily. This doesn't reset the servo first;
+  only the settings that differ from the current ones are written. Settings that
+  take effect immediately (speed, softStart, failSafe, powerLimit,
+  overloadProtection) are lost when the servo is power-cycled or rebooted. The
+  other settings (including turning failSafeLimp on or off) only take effect
+  after a reboot, which also discards unsaved settings; so if any of those
+  changed, they're saved and the servo is rebooted (and applySettingsVolatile()
+  waits until it's ready) before the others are written. If `previousOut` isn't
+  NULL, it gets the settings from before the change. revertVolatile() writes
+  them back the same way, except that if it has to save the servo, it saves the
+  previous values of all the settings, so:
+      HitecDSettings previous;
+      servo.applySettingsVolatile(temporarySettings, &previous);
+      ...
+      servo.revertVolatile(previous);
+  returns the servo to how it was, both now and after it's power-cycled. (Saving
+  also saves any earlier unsaved changes, so don't nest these calls.) The same
+  model restrictions apply as for writeSettings(). */
+  int applySettingsVolatile(
+    const HitecDSettings &settings,
+    HitecDSettings *previousOut = NULL);
+  int applySettingsVolatileUnsupportedModelThisMightDamageTheServo(
+    const HitecDSettings &settings,
+    bool allowUnsupportedModel,
+    HitecDSettings *previousOut = NULL);
+  int revertVolatile(const HitecDSettings &previous);
+
+  /* A settings session batches several changes into a single SAVE (and at
+  most one reboot), for example while tuning:
+      HitecDSettingsSession session;
+      servo.beginSettingsSession(&session);
+      ... servo.stageSettings(trialSettings); ...
+      servo.commitSettingsSession(HITECD_WRITE_WAIT_UNTIL_READY);
+  beginSettingsSession() reads the current settings. stageSettings() records new
+  settings; the ones that take effect immediately (speed, softStart, failSafe
+  other than failSafeLimp, powerLimit, overloadProtection) are written right
+  away without saving, and the others wait for commitSettingsSession(). That
+  writes them, saves everything once, and reboots the servo if needed, returning
+  HITECD_OK_REBOOTING (or HITECD_OK if it didn't need to reboot, or if
+  HITECD_WRITE_WAIT_UNTIL_READY was passed). If nothing changed, nothing is
+  saved. abortSettingsSession() writes back the settings from when the session
+  began. `session` must stay valid until the session is committed or aborted.
+  stageSettings() and commitSettingsSession() return HITECD_ERR_NO_SESSION
+  outside of a session. */
+  int beginSettingsSession(HitecDSettingsSession *session);
+  int stageSettings(const HitecDSettings &settings);
+  int commitSettingsSession(uint8_t flags = 0);
+  int abortSettingsSession();
+
+  /* Each SAVE wears the servo's EEPROM a little. getSaveCount() returns how
+  many times this HitecDServo has written SAVE (by any method, including
+  writeRawRegister()). To keep a count across power cycles, store it somewhere
+  and pass it to setSaveCount() after attach(). If setSaveBudget() is given a
+  nonzero budget, then once getSaveCount() reaches it, everything that would
+  save (writeSettings(), applySettingsImage(), commitSettingsSession(), and
+  applySettingsVolatile() if it needs to reboot) returns
+  HITECD_ERR_SAVE_BUDGET without writing anything. */
+  uint32_t getSaveCount();
+  void setSaveCount(uint32_t count);
+  void setSaveBudget(uint32_t budget);
+
+  /* A settings image is a list of ready-to-send register frames that does the
+  same thing as writeSettings(); see HITECD_IMAGE_HEADER() below.
+  encodeSettingsImage() works out the image for the given settings on this
+  servo, stores it in `imageOut`, and returns its length in bytes (at most
+  HITECD_SETTINGS_IMAGE_MAX_LEN), or an error code. It doesn't change the
+  servo's settings. For example, the Programmer example's "image" command
+  prints the image for the current settings, so it can be pasted into a sketch:
+      const uint8_t myImage[] PROGMEM = { ...pasted here... };
+  Then applySettingsImage(myImage) sends it to any servo of the same model,
+  without reading anything from the servo first. `image` must be in PROGMEM.
+  `flags` may be HITECD_WRITE_WAIT_UNTIL_READY, or 0. Like writeSettings(), the
+  servo reboots afterwards, and both methods return
+  HITECD_ERR_UNSUPPORTED_MODEL for models that aren't fully supported. */
+  int encodeSettingsImage(
+    const HitecDSettings &settings,
+    uint8_t *imageOut,
+    uint16_t maxLen);
+  int applySettingsImage(const uint8_t *image, uint8_t flags = 0);
+
+  /* After the servo reboots (e.g. after writeSettings()), it ignores commands
+  for about 1000ms, and drives the line low the whole time. waitUntilReady()
+  watches the line, and returns HITECD_OK as soon as the servo lets go of it, or
+  HITECD_ERR_BOOTING_OR_NO_PULLUP if that doesn't happen within
+  `timeoutMillis`. If the servo isn't rebooting, it returns HITECD_OK after
+  about 20ms. */
+  int waitUntilReady(unsigned long timeoutMillis);
 
   /* Directly read/write registers on the servo. Don't use this unless you know
   what you're doing. (The only reason these methods are declared public is so
@@ -71,14 +245,223 @@ public:
   int readRawRegister(uint8_t reg, uint16_t *valOut);
   void writeRawRegister(uint8_t reg, uint16_t val);
 
+  /* Every register read takes about 17ms. To avoid re-reading registers that
+  can't have changed, you can give the servo a HitecDRegisterCache:
+      HitecDRegisterCache cache;
+      ...
+      servo.useRegisterCache(&cache);
+  Then readRawRegister() (and therefore readSettings(), etc.) answers reads of
+  the settings registers, and of some registers that never change, from RAM
+  once it has read or written them. The cache assumes that nothing else changes
+  the servo's settings; for example, don't also program the servo with a DPC-11
+  while it's attached. Writing FACTORY_RESET, or writing REBOOT without SAVE,
+  drops the affected registers from the cache. Pass NULL to stop using the
+  cache. The cache costs 60 bytes of RAM, which is why it's opt-in.
+
+  writeCachedRegister() records a write in the cache without sending it; if the
+  register already has that value, nothing will be sent at all.
+  flushRegisterCache() sends all the recorded writes. Without a cache,
+  writeCachedRegister() is the same as writeRawRegister(). */
+  void useRegisterCache(HitecDRegisterCache *cache);
+  void writeCachedRegister(uint8_t reg, uint16_t val);
+  void flushRegisterCache();
+
+  /* Keeps a copy of each servo's settings in the Arduino's EEPROM, so that
+  after a power cycle, attach() and readSettings() don't have to read them from
+  the servo again. For example:
+      servo.useSettingsEEPROM(0, 4);
+      servo.attach(pin);
+  uses EEPROM bytes 0 to 4*HITECD_EEPROM_SLOT_LEN-1 to remember the settings of
+  up to four servos. Call it before attach(). Servos are told apart by model
+  number and by a per-unit constant read from the servo. On a servo it has seen
+  before, attach() reads just those two registers, and readSettings() doesn't
+  read anything. The first readSettings() of all fields on a new servo stores
+  its settings (unless there are unsaved changes, e.g. from
+  applySettingsVolatile() or stageSettings()); writeSettings() and
+  applySettingsImage() update or drop the stored copy. Like the register cache,
+  this assumes that nothing else changes the servo's settings. Several
+  HitecDServo instances can share the same slots. Pass 0 slots to stop using the
+  EEPROM.
+
+  The per-unit constant isn't guaranteed to be unique, so two servos of the
+  same model can end up sharing a slot, and one gets the other's settings
+  without any warning. Only use this if each servo's constant is different, or
+  if servos with the same constant also have the same settings. */
+  void useSettingsEEPROM(uint16_t eepromAddress, uint8_t numSlots);
+
+  /* Marks this servo's stored copy as out of date, e.g. because something else
+  changed its settings, and re-reads the range registers that attach() took
+  from it. Returns HITECD_OK, or an error code if the servo is attached and
+  the range couldn't be read. */
+  int forgetSettingsEEPROM();
+
+  /* Reads several registers in a row: `valsOut[i]` gets the value of register
+  `regs[i]`. This is faster than calling readRawRegister() in a loop, because it
+  leaves a shorter gap between reads. If `resultsOut` isn't NULL,
+  `resultsOut[i]` gets the result of reading `regs[i]`. Returns HITECD_OK if
+  all the reads succeeded, or else the first error. */
+  int readRawRegisters(
+    const uint8_t *regs,
+    uint8_t n,
+    uint16_t *valsOut,
+    int *resultsOut = NULL);
+
+  /* Non-blocking version of readRawRegister(). Reading a register takes about
+  17ms, but almost all of that time is spent waiting for the servo to respond.
+  beginReadRawRegister() sends the request and returns right away. Then call
+  pollReadRawRegister() repeatedly; it returns HITECD_PENDING while the read is
+  still in progress, and HITECD_OK (with the value stored in *valOut) or an
+  error code once the read is finished.
+
+  The servo's response has to be received at a precise time, so once the read
+  has begun, pollReadRawRegister() must be called at least once per millisecond.
+  Once per read, it blocks for up to about 2ms: up to 1ms waiting for the
+  response to start, and then up to about 1ms receiving it. (With
+  useTimerReceive(), it doesn't block.) Don't call any other methods on this
+  servo until the read is finished. */
+  int beginReadRawRegister(uint8_t reg);
+  int pollReadRawRegister(uint16_t *valOut);
+
+  /* Retrieves the response latency measurements; see HitecDLatencyStats.
+  (Reads received with useTimerReceive() aren't measured.) */
+  void getLatencyStats(HitecDLatencyStats *statsOut);
+
+  /* By default, the library bit-bangs each frame to the servo with interrupts
+  disabled, which takes about 610us for a register write. useTimerTransmit(true)
+  instead clocks frames out from a hardware timer interrupt, one bit per
+  interrupt, so interrupts stay enabled between bits. writeRawRegister() (and
+  therefore writeTargetQuarterMicros(), etc.) then returns as soon as the frame
+  has been queued, and transmitDone() returns false until it has been sent.
+
+  This uses Timer2 (or Timer1 on boards without a Timer2, such as the
+  ATmega32U4), so it can't be combined with other code that uses that timer,
+  like tone() or the standard Servo library. It requires a 16MHz or faster
+  clock; otherwise it returns HITECD_ERR_NO_TIMER. Other interrupt handlers
+  delay the bit edges, so they must be short (a few microseconds at most). */
+  int useTimerTransmit(bool enable);
+  bool transmitDone();
+
+  /* By default, the servo's response to a register read is also received by
+  bit-banging with interrupts disabled. useTimerReceive(true) instead arms a
+  pin-change interrupt for the start bit of each byte, and samples the bits
+  from the same timer interrupt as useTimerTransmit(). Interrupts stay enabled
+  except at the sampling instants, and pollReadRawRegister() never blocks. Call
+  this after attach(). It has the same requirements as useTimerTransmit(), and
+  additionally the pin must support pin-change interrupts (on the ATmega32U4,
+  only the PORTB pins do), or it returns HITECD_ERR_NO_TIMER. It can't be
+  combined with SoftwareSerial, which also uses pin-change interrupts. */
+  int useTimerReceive(bool enable);
+
+protected:
+  /* Send or receive a single byte by bit-banging the pin. readByte() polls for
+  the start bit up to `*timeoutLoops` times, in a loop that takes
+  readByteLoopCycles() cycles per iteration, and leaves the polls it didn't use
+  in `*timeoutLoops`. The caller works out the count before disabling
+  interrupts (see hitecdTimeoutLoops()). These are virtual so that
+  HitecDServoPin (see HitecDServoPin.h) can replace them with versions
+  specialized for a fixed pin. */
+  virtual void writeByte(uint8_t value);
+  virtual int readByte(uint32_t *timeoutLoops);
+  virtual uint8_t readByteLoopCycles();
+
 private:
-  void writeByte(uint8_t value);
-  int readByte();
+  /* HitecDServoGroup drives the pins of several servos directly.
+  HitecDServoCoordinator sends frames to several servos back-to-back.
+  HitecDServoSampler shortens the gap between its reads. */
+  friend class HitecDServoGroup;
+  friend class HitecDServoCoordinator;
+  friend class HitecDServoSampler;
+
+  void writeFrame(const uint8_t *frame, uint8_t len);
+  int receiveResponse(uint8_t *response, unsigned long *startBitMicrosOut);
+  unsigned long responseWindowStart();
+  unsigned long responseWindowLength();
+  void recordLatency(unsigned long latencyMicros);
+  int readSmartSenseConstants(uint16_t *ssConstsOut);
+  int writeSettingsDelta(const HitecDSettings &settings, uint8_t flags);
+  void writeSettingsRegister(
+    uint8_t reg,
+    uint16_t val,
+    const HitecDSettings &reference,
+    bool *rebootOut);
+  int readRange();
+  bool loadEEPROMSettings(HitecDSettings *settingsOut);
+  void storeEEPROMSettings(const HitecDSettings &settings);
+  void invalidateEEPROMSettings();
+  void trackUnsavedWrites(uint8_t reg);
+  bool saveBudgetExhausted();
+  int applyVolatile(
+    const HitecDSettings &settings,
+    bool allowUnsupportedModel,
+    HitecDSettings *previousOut,
+    bool saveLive);
+  int writeDiffRegisters(
+    const HitecDSettings &settings,
+    const HitecDSettings &reference,
+    bool rebootRegisters,
+    bool *wroteOut);
+  int writeChangedSettings(
+    const HitecDSettings &settings,
+    const HitecDSettings &reference,
+    bool *changedOut,
+    bool *rebootOut);
+  int beginMoveCheckRead(uint8_t reg);
+  int8_t cacheIndex(uint8_t reg);
+  void updateCacheAfterWrite(uint8_t reg, uint16_t val);
+  int parseResponse(const uint8_t *response);
 
   int pin;
   uint8_t pinBitMask;
   volatile uint8_t *pinInputRegister, *pinOutputRegister;
 
+  /* Set by useTimerTransmit(). This is a function pointer so that the
+  interrupt-driven engine is only linked into sketches that use it. */
+  void (*timerWriteFrame)(
+    volatile uint8_t *outputRegister,
+    uint8_t bitMask,
+    const uint8_t *frame,
+    uint8_t len);
+
+  /* Set by useTimerReceive(), for the same reason. */
+  const HitecDTimerReceiver *timerReceiver;
+
+  /* State of the read started by beginReadRawRegister() */
+  uint8_t readState;
+  uint8_t readReg;
+  int readResult;
+  uint16_t readValue;
+  unsigned long readStartMicros, readDeadlineMicros;
+  uint16_t readCooldownMicros;
+
+  HitecDLatencyStats latencyStats;
+
+  /* Set by useRegisterCache() */
+  HitecDRegisterCache *registerCache;
+
+  /* Set by useSettingsEEPROM(). eepromSlot is the slot for this servo, or -1
+  if it hasn't got one yet; eepromValid is whether the slot is up to date. */
+  uint16_t eepromAddress;
+  uint8_t eepromNumSlots;
+  int8_t eepromSlot;
+  bool eepromValid;
+  uint16_t fingerprint;
+
+  /* Whether anything has been written since the last SAVE or REBOOT that the
+  servo might not have saved */
+  bool unsavedWrites;
+
+  /* Set by beginSettingsSession() */
+  HitecDSettingsSession *session;
+
+  uint32_t saveCount, saveBudget;
+
+  /* Set by setMoveCompleteThresholds(), and the state of
+  beginWaitForMoveComplete() */
+  int16_t moveMaxVelocity, moveMaxTrackingError;
+  uint8_t moveSettledReads, moveSettledCount;
+  uint8_t moveState;
+  unsigned long moveStartMillis, moveTimeoutMillis;
+
   int modelNumber;
   int16_t rangeLeftAPV, rangeRightAPV, rangeCenterAPV;
 };
@@ -112,7 +495,9 @@ struct HitecDSettings {
   static const bool defaultCounterclockwise = false;
 
   /* `speed` defines how fast the servo moves to a new position, as a percentage
-  of maximum speed. Legal values are 10, 20, 30, 40, 50, 60, 70, 80, 90, 100. */
+  of maximum speed. Legal values are multiples of 5 from 5 to 100. The DPC-11
+  only offers 10, 20, ... 100, but the register has a step for every 5%, and the
+  DPC-11 itself uses 25 in EPA setting mode. */
   int8_t speed;
   static const int8_t defaultSpeed = 100;
 
@@ -226,12 +611,150 @@ struct HitecDSettings {
   static const int16_t defaultSensitivityRatio = 4095;
 };
 
+/* Storage for a settings session; see HitecDServo::beginSettingsSession().
+The fields are managed by HitecDServo. */
+struct HitecDSettingsSession {
+  HitecDSettings saved, staged;
+};
+
+/* A snapshot of the servo's live state; see HitecDServo::readTelemetry().
+These come from undocumented registers, so the descriptions below are
+educated guesses. Each field has a timestamp: micros() at the end of the
+request for that register, which is about when the servo sampled it. */
+struct HitecDTelemetry {
+  /* The HITECD_TELEMETRY_* flags of the fields that were read successfully by
+  the last call to readTelemetry(). */
+  uint8_t validMask;
+
+  /* The servo's position, in APV units (see readCurrentAPV()) */
+  int16_t currentAPV;
+  unsigned long currentAPVMicros;
+
+  /* Two measurements of how fast the servo is moving, in unknown units. Both
+  are typically 0, 1, or -1 when the servo is stationary. */
+  int16_t velocity;
+  unsigned long velocityMicros;
+  int16_t velocity2;
+  unsigned long velocity2Micros;
+
+  /* How hard the motor is pushing, in the same units as
+  HitecDSettings::powerLimit; negative when pushing towards lower APVs. 0 if
+  the motor is off. */
+  int16_t motorPower;
+  unsigned long motorPowerMicros;
+
+  /* The power limit actually in force: powerLimit (capped at 2000), reduced if
+  overload protection has kicked in. If abs(motorPower) reaches this, the servo
+  is probably stalled. */
+  int16_t effectivePowerLimit;
+  unsigned long effectivePowerLimitMicros;
+
+  /* The target point, in APV units */
+  int16_t targetAPV;
+  unsigned long targetAPVMicros;
+
+  /* Probably the difference between currentAPV and targetAPV */
+  int16_t trackingError;
+  unsigned long trackingErrorMicros;
+
+  /* 1 if the servo is moving (or last moved) towards higher APVs, -1 if
+  towards lower APVs */
+  int8_t travelDirection;
+  unsigned long travelDirectionMicros;
+};
+
+/* Fields for readTelemetry(). Each one selects the HitecDTelemetry field of
+the same name. */
+#define HITECD_TELEMETRY_CURRENT_APV 0x01
+#define HITECD_TELEMETRY_VELOCITY 0x02
+#define HITECD_TELEMETRY_VELOCITY_2 0x04
+#define HITECD_TELEMETRY_MOTOR_POWER 0x08
+#define HITECD_TELEMETRY_EFFECTIVE_POWER_LIMIT 0x10
+#define HITECD_TELEMETRY_TARGET_APV 0x20
+#define HITECD_TELEMETRY_TRACKING_ERROR 0x40
+#define HITECD_TELEMETRY_TRAVEL_DIRECTION 0x80
+#define HITECD_TELEMETRY_ALL 0xFF
+
+/* Default thresholds for isMoving() and waitForMoveComplete(). The velocity
+registers typically read 0, 1, or -1 when the servo is stationary. */
+#define HITECD_MOVE_DEFAULT_MAX_VELOCITY 1
+#define HITECD_MOVE_DEFAULT_MAX_TRACKING_ERROR 10
+
+/* Fields for readSettings(). Each one selects the HitecDSettings field(s) of
+the same name. HITECD_FIELD_RANGE selects rangeLeftAPV, rangeRightAPV, and
+rangeCenterAPV; HITECD_FIELD_FAIL_SAFE selects failSafe and failSafeLimp. */
+#define HITECD_FIELD_ID 0x0001
+#define HITECD_FIELD_COUNTERCLOCKWISE 0x0002
+#define HITECD_FIELD_SPEED 0x0004
+#define HITECD_FIELD_DEADBAND 0x0008
+#define HITECD_FIELD_SOFT_START 0x0010
+#define HITECD_FIELD_RANGE 0x0020
+#define HITECD_FIELD_FAIL_SAFE 0x0040
+#define HITECD_FIELD_POWER_LIMIT 0x0080
+#define HITECD_FIELD_OVERLOAD_PROTECTION 0x0100
+#define HITECD_FIELD_SMART_SENSE 0x0200
+#define HITECD_FIELD_SENSITIVITY_RATIO 0x0400
+#define HITECD_FIELD_ALL 0x07FF
+
+/* Flags for writeSettings() */
+
+/* Instead of resetting the servo to factory defaults and writing every
+setting, read the current settings (from the register cache, if there is one),
+and write only the registers that differ, along with the extra registers that
+the DPC-11 writes with them. The servo is saved, but only rebooted if one of the
+changed settings takes effect only after a reboot (ID, counterclockwise,
+deadband, range, smartSense, sensitivityRatio, or turning failSafeLimp on or
+off). In that case, writeSettings() returns HITECD_OK_REBOOTING instead of
+HITECD_OK, and the servo won't respond for 1000ms. Changing only speed,
+softStart, the failSafe point, powerLimit, or overloadProtection doesn't require
+a reboot. If nothing changed, nothing is written. */
+#define HITECD_WRITE_DELTA 0x01
+
+/* After rebooting the servo, wait until it's ready (see waitUntilReady())
+before returning. With HITECD_WRITE_DELTA, writeSettings() then returns
+HITECD_OK rather than HITECD_OK_REBOOTING. */
+#define HITECD_WRITE_WAIT_UNTIL_READY 0x02
+
+/* Layout of a settings image (see encodeSettingsImage()): a header, then
+any number of HITECD_IMAGE_FRAME()s, then HITECD_IMAGE_END. The header records
+the model number that the image is for, and the range that the image leaves the
+servo with (-1 if unknown). Each frame is exactly what writeRawRegister()
+would send. Images can also be written by hand with these macros, e.g.:
+    const uint8_t myImage[] PROGMEM = {
+      HITECD_IMAGE_HEADER(485, 3381, 13002, 8192),
+      HITECD_IMAGE_FRAME(0x6E, 0x0F0F), ...,
+      HITECD_IMAGE_END
+    }; */
+#define HITECD_IMAGE_MAGIC 0xD5
+#define HITECD_IMAGE_U16(val) ((val) & 0xFF), (((val) >> 8) & 0xFF)
+#define HITECD_IMAGE_HEADER(modelNumber, leftAPV, rightAPV, centerAPV) \
+  HITECD_IMAGE_MAGIC, HITECD_IMAGE_U16(modelNumber), \
+  HITECD_IMAGE_U16(leftAPV), HITECD_IMAGE_U16(rightAPV), \
+  HITECD_IMAGE_U16(centerAPV)
+#define HITECD_IMAGE_FRAME(reg, val) \
+  0x96, 0x00, (reg), 0x02, HITECD_IMAGE_U16(val), \
+  (((reg) + 0x02 + ((val) & 0xFF) + (((val) >> 8) & 0xFF)) & 0xFF)
+#define HITECD_IMAGE_END 0x00
+
+#define HITECD_IMAGE_HEADER_LEN 9
+#define HITECD_IMAGE_FRAME_LEN 7
+/* Factory reset, MYSTERY_OP1/2, up to 20 settings registers, save, reboot */
+#define HITECD_SETTINGS_IMAGE_MAX_LEN \
+  (HITECD_IMAGE_HEADER_LEN + 25 * HITECD_IMAGE_FRAME_LEN + 1)
+
 /* Many of the functions in this library return error codes. The possible error
 codes are as follows: */
 
 /* OK (no error occurred) */
 #define HITECD_OK 1
 
+/* pollReadRawRegister() returns this if the read isn't finished yet. */
+#define HITECD_PENDING 0
+
+/* writeSettings() with HITECD_WRITE_DELTA returns this if it succeeded, and
+had to reboot the servo. */
+#define HITECD_OK_REBOOTING 2
+
 /* attach() was not called, or the call to attach() failed. */
 #define HITECD_ERR_NOT_ATTACHED (-101)
 
@@ -252,6 +775,41 @@ is missing. With a 5V microcontroller, use a 2k pullup resistor to +5V. With a
 /* Confusing response from servo. */
 #define HITECD_ERR_CONFUSED (-106)
 
+/* A non-blocking read is already in progress. */
+#define HITECD_ERR_BUSY (-107)
+
+/* pollReadRawRegister() wasn't called often enough, so the servo's response
+was missed. */
+#define HITECD_ERR_MISSED_RESPONSE (-108)
+
+/* The interrupt-driven engine isn't available on this board or clock speed. */
+#define HITECD_ERR_NO_TIMER (-109)
+
+/* All the servos in a HitecDServoGroup must be on pins of the same port. */
+#define HITECD_ERR_WRONG_PORT (-110)
+
+/* A HitecDServoGroup or HitecDServoScheduler can't have more than 8 servos. */
+#define HITECD_ERR_GROUP_FULL (-111)
+
+/* The settings image is for a different model of servo. */
+#define HITECD_ERR_WRONG_MODEL (-112)
+
+/* The settings image is malformed, or too big for the buffer. */
+#define HITECD_ERR_BAD_IMAGE (-113)
+
+/* The budget set by setSaveBudget() has been used up. */
+#define HITECD_ERR_SAVE_BUDGET (-114)
+
+/* stageSettings() or commitSettingsSession() was called without
+beginSettingsSession(). */
+#define HITECD_ERR_NO_SESSION (-115)
+
+/* waitForMoveComplete() timed out before the servo stopped moving. */
+#define HITECD_ERR_MOVE_TIMEOUT (-116)
+
+/* A HitecDServoGroup already has a servo on that pin. */
+#define HITECD_ERR_SAME_PIN (-117)
+
 /* `hitecdErrToString()` returns a string description of the given error code.
 You can print this with Serial for debugging purposes. For example:
     int res = doSomething();
@@ -0,0 +1,438 @@
+#ifndef HitecDServoBitEngine_h
+#define HitecDServoBitEngine_h
+
+/* Cycle-exact bit-banging engine for the 115200 baud serial protocol. This
+header is internal to the library.
+
+The bit loops are written in inline assembly, so the number of clock cycles
+spent on each bit is known exactly, instead of depending on the compiler. The
+delays are generated from F_CPU at compile time: each bit lasts exactly
+HD_BIT_CYCLES cycles, which is F_CPU/115200 rounded to the nearest cycle.
+
+Timing error budget
+-------------------
+Rounding to a whole number of cycles makes our bit rate slightly off:
+
+    F_CPU    exact cycles/bit  HD_BIT_CYCLES  rate error  drift at stop bit
+    8MHz     69.44             69             -0.64%      0.06 bit
+    12MHz    104.17            104            -0.16%      0.02 bit
+    16MHz    138.89            139            +0.08%      0.01 bit
+    20MHz    173.61            174            +0.22%      0.02 bit
+
+("Drift at stop bit" is how far the middle of the stop bit has moved after 9.5
+bit periods.) A UART receiver resynchronizes on every start bit, and typically
+tolerates a total error of about +/-0.4 bit at the stop bit.
+
+When receiving, there's an additional error because we detect the start bit by
+polling the pin in a loop (HD_WAIT_LOOP_CYCLES cycles per iteration), so we
+don't know exactly when the edge happened. We aim for the average case, so the
+sampling points can be off by up to half a loop iteration in either direction:
+at 8MHz that's 4.5 cycles, or 0.07 bit.
+
+Both budgets are enforced at compile time below: the rate error must be at most
+1%, and the worst-case receive sampling error (drift plus polling uncertainty)
+must be at most 0.25 bit. Every delay in the bit loops must also come out
+between 0 and 767 cycles, the range HD_ASM_DELAY() can produce. Any F_CPU that
+satisfies these works. The checks are written as functions of the clock, so
+besides the F_CPU being compiled for, the table above is checked too: 8, 12, 16
+and 20MHz must all pass, and must round to the cycle counts shown. */
+
+#include <Arduino.h>
+
+#include "HitecDServo.h"
+
+#define HD_BAUD 115200L
+
+constexpr long hitecdBitCycles(long fCpu) {
+  return (fCpu + HD_BAUD / 2) / HD_BAUD;
+}
+
+#define HD_BIT_CYCLES hitecdBitCycles(F_CPU)
+
+/* Cycles per iteration of the start-bit polling loop, for the pointer-based
+(HitecDServo) and I/O-address-based (HitecDServoPin) variants. */
+#define HD_WAIT_LOOP_CYCLES 9
+#define HD_WAIT_LOOP_CYCLES_IO 8
+
+/* Converts a timeout into a number of iterations of a polling loop that takes
+`loopCycles` cycles per iteration. This divides at runtime, which takes tens of
+microseconds, so do it before disabling interrupts. */
+static inline uint32_t hitecdTimeoutLoops(
+  uint32_t timeoutMicros,
+  uint8_t loopCycles
+) {
+  return timeoutMicros * (F_CPU / 1000000L) / loopCycles + 1;
+}
+
+/* Rate error in parts per million */
+constexpr long hitecdRateErrorPPM(long fCpu) {
+  return (hitecdBitCycles(fCpu) * HD_BAUD > fCpu ?
+    hitecdBitCycles(fCpu) * HD_BAUD - fCpu :
+    fCpu - hitecdBitCycles(fCpu) * HD_BAUD) * 1000000LL / fCpu;
+}
+
+/* Worst-case receive sampling error at the stop bit, in thousandths of a
+bit: drift over 9.5 bits plus half a polling-loop iteration. */
+constexpr long hitecdSamplingErrorMilliBits(long fCpu) {
+  return hitecdRateErrorPPM(fCpu) * 95 / 10 / 1000 +
+    (HD_WAIT_LOOP_CYCLES * 1000 / 2) / hitecdBitCycles(fCpu);
+}
+
+constexpr bool hitecdDelayFits(long cycles) {
+  return cycles >= 0 && cycles / 3 <= 255;
+}
+
+/* Whether every delay in the bit loops below fits, for `b` cycles per bit.
+These are the HD_ASM_DELAY_OPERANDS() of each loop, in order; keep them in sync
+with the loops' cycle accounting. */
+constexpr bool hitecdDelaysFit(long b) {
+  return
+    /* hitecdWriteByteExact() */
+    hitecdDelayFits(b - 6) && hitecdDelayFits(b - 9) &&
+    hitecdDelayFits(b - 2) &&
+    /* hitecdWriteByteExactIO() */
+    hitecdDelayFits(b - 5) && hitecdDelayFits(b - 8) &&
+    hitecdDelayFits(b - 1) &&
+    /* hitecdWriteSlotsExact() */
+    hitecdDelayFits(b - 8) &&
+    /* hitecdCaptureExact() */
+    hitecdDelayFits((b + 1) / 3 - 7) &&
+    /* hitecdReadByteExact() */
+    hitecdDelayFits(b * 3 / 2 - 11) && hitecdDelayFits(b - 8) &&
+    /* hitecdReadByteExactIO() */
+    hitecdDelayFits((b * 3 - 19) / 2) && hitecdDelayFits(b - 7);
+}
+
+constexpr bool hitecdClockWorks(long fCpu) {
+  return hitecdRateErrorPPM(fCpu) <= 10000 &&
+    hitecdSamplingErrorMilliBits(fCpu) <= 250 &&
+    hitecdDelaysFit(hitecdBitCycles(fCpu));
+}
+
+static_assert(hitecdRateErrorPPM(F_CPU) <= 10000,
+  "F_CPU isn't close enough to a multiple of 115200 for the servo protocol");
+static_assert(hitecdSamplingErrorMilliBits(F_CPU) <= 250,
+  "F_CPU is too slow to receive the servo protocol reliably");
+static_assert(hitecdDelaysFit(HD_BIT_CYCLES),
+  "F_CPU is out of range for the bit loops' delays");
+
+/* The clocks in the table above */
+static_assert(hitecdBitCycles(8000000L) == 69 && hitecdClockWorks(8000000L),
+  "8MHz timing budget");
+static_assert(hitecdBitCycles(12000000L) == 104 && hitecdClockWorks(12000000L),
+  "12MHz timing budget");
+static_assert(hitecdBitCycles(16000000L) == 139 && hitecdClockWorks(16000000L),
+  "16MHz timing budget");
+static_assert(hitecdBitCycles(20000000L) == 174 && hitecdClockWorks(20000000L),
+  "20MHz timing budget");
+
+/* HD_ASM_DELAY("x") emits exactly %[xc] cycles of delay, where the operands
+are declared by HD_ASM_DELAY_OPERANDS(x, cycles). It uses a 3-cycle countdown
+loop plus 0-2 nops, and needs a scratch upper register named %[dly]. */
+#define HD_ASM_DELAY(name) \
+  ".if %[" name "k]\n\t" \
+  "ldi %[dly], %[" name "k]\n" \
+  "1:\n\t" \
+  "dec %[dly]\n\t" \
+  "brne 1b\n\t" \
+  ".endif\n\t" \
+  ".rept %[" name "r]\n\t" \
+  "nop\n\t" \
+  ".endr\n\t"
+#define HD_ASM_DELAY_OPERANDS(name, cycles) \
+  [name ## k] "n" ((cycles) / 3), \
+  [name ## r] "n" ((cycles) % 3)
+
+/* Writes one byte. `port` is the PORTx register; `high` and `low` are the
+values to write to it to drive the pin high or low. Polarity is inverted, so
+the start bit is high, 1 bits are low, and the stop bit is low. The caller
+disables interrupts.
+
+Cycle accounting (st is 2 cycles):
+- start bit to first data bit: st, ldi, d0, mov, sbrc/mov = 6 + d0
+- data bit to data bit: st, lsr, d1, dec, brne, mov, sbrc/mov = 9 + d1
+- last data bit to stop bit: st, lsr, d1, dec, brne (not taken), d2 = 5+d1+d2
+- stop bit: st, d3 = 2 + d3 */
+static inline void hitecdWriteByteExact(
+  volatile uint8_t *port,
+  uint8_t high,
+  uint8_t low,
+  uint8_t val
+) {
+  uint8_t cnt, tmp, dly;
+  asm volatile (
+    "st Z, %[high]\n\t"
+    "ldi %[cnt], 8\n\t"
+    HD_ASM_DELAY("d0")
+    "2:\n\t"
+    "mov %[tmp], %[high]\n\t"
+    "sbrc %[val], 0\n\t"
+    "mov %[tmp], %[low]\n\t"
+    "st Z, %[tmp]\n\t"
+    "lsr %[val]\n\t"
+    HD_ASM_DELAY("d1")
+    "dec %[cnt]\n\t"
+    "brne 2b\n\t"
+    HD_ASM_DELAY("d2")
+    "st Z, %[low]\n\t"
+    HD_ASM_DELAY("d3")
+    : [val] "+r" (val), [cnt] "=&d" (cnt), [tmp] "=&r" (tmp),
+      [dly] "=&d" (dly)
+    : [port] "z" (port), [high] "r" (high), [low] "r" (low),
+      HD_ASM_DELAY_OPERANDS(d0, HD_BIT_CYCLES - 6),
+      HD_ASM_DELAY_OPERANDS(d1, HD_BIT_CYCLES - 9),
+      HD_ASM_DELAY_OPERANDS(d2, 4),
+      HD_ASM_DELAY_OPERANDS(d3, HD_BIT_CYCLES - 2)
+    : "memory"
+  );
+}
+
+/* Same as hitecdWriteByteExact(), but `portAddress` is the I/O address of the
+PORTx register, known at compile time. (out is 1 cycle.)
+- start bit to first data bit: out, ldi, d0, mov, sbrc/mov = 5 + d0
+- data bit to data bit: out, lsr, d1, dec, brne, mov, sbrc/mov = 8 + d1
+- last data bit to stop bit: out, lsr, d1, dec, brne (not taken), d2 = 4+d1+d2
+- stop bit: out, d3 = 1 + d3 */
+template<uint8_t portAddress>
+static inline void hitecdWriteByteExactIO(
+  uint8_t high,
+  uint8_t low,
+  uint8_t val
+) {
+  uint8_t cnt, tmp, dly;
+  asm volatile (
+    "out %[port], %[high]\n\t"
+    "ldi %[cnt], 8\n\t"
+    HD_ASM_DELAY("d0")
+    "2:\n\t"
+    "mov %[tmp], %[high]\n\t"
+    "sbrc %[val], 0\n\t"
+    "mov %[tmp], %[low]\n\t"
+    "out %[port], %[tmp]\n\t"
+    "lsr %[val]\n\t"
+    HD_ASM_DELAY("d1")
+    "dec %[cnt]\n\t"
+    "brne 2b\n\t"
+    HD_ASM_DELAY("d2")
+    "out %[port], %[low]\n\t"
+    HD_ASM_DELAY("d3")
+    : [val] "+r" (val), [cnt] "=&d" (cnt), [tmp] "=&r" (tmp),
+      [dly] "=&d" (dly)
+    : [port] "I" (portAddress), [high] "r" (high), [low] "r" (low),
+      HD_ASM_DELAY_OPERANDS(d0, HD_BIT_CYCLES - 5),
+      HD_ASM_DELAY_OPERANDS(d1, HD_BIT_CYCLES - 8),
+      HD_ASM_DELAY_OPERANDS(d2, 4),
+      HD_ASM_DELAY_OPERANDS(d3, HD_BIT_CYCLES - 1)
+    : "memory"
+  );
+}
+
+/* Writes `n` precomputed bit slots to the port, one per bit period. Each slot
+holds the levels of the pins being driven; it's ORed with `base`, which holds
+the levels of the rest of the port, and written with a single store. This is how
+HitecDServoGroup drives several servos at once. The caller disables interrupts.
+
+Cycle accounting: st, d0, dec, brne, ld, or = 8 + d0 between stores. */
+static inline void hitecdWriteSlotsExact(
+  volatile uint8_t *port,
+  uint8_t base,
+  const uint8_t *slots,
+  uint8_t n
+) {
+  uint8_t tmp, dly;
+  asm volatile (
+    "2:\n\t"
+    "ld %[tmp], X+\n\t"
+    "or %[tmp], %[base]\n\t"
+    "st Z, %[tmp]\n\t"
+    HD_ASM_DELAY("d0")
+    "dec %[n]\n\t"
+    "brne 2b\n\t"
+    : [n] "+r" (n), [slots] "+x" (slots), [tmp] "=&r" (tmp),
+      [dly] "=&d" (dly)
+    : [port] "z" (port), [base] "r" (base),
+      HD_ASM_DELAY_OPERANDS(d0, HD_BIT_CYCLES - 8)
+    : "memory"
+  );
+}
+
+/* HitecDServoGroup receives from several servos at once by capturing the whole
+PINx register at 3x the bit rate, then decoding each pin afterwards. */
+#define HD_CAPTURE_SAMPLES 256
+#define HD_SAMPLE_CYCLES ((HD_BIT_CYCLES + 1) / 3)
+
+/* Polls up to `timeoutLoops` times (see hitecdTimeoutLoops()) for any of the
+pins in `mask` to go high (the start bit of the first byte), then captures
+HD_CAPTURE_SAMPLES samples of the PINx register into `samples`, one every
+HD_SAMPLE_CYCLES cycles. Returns false on timeout. The caller disables
+interrupts.
+
+Cycle accounting: ld, st, d0, dec, brne = 7 + d0 between samples. */
+static inline bool hitecdCaptureExact(
+  volatile uint8_t *pinReg,
+  uint8_t mask,
+  uint8_t *samples,
+  uint32_t timeoutLoops
+) {
+  uint8_t t0 = timeoutLoops, t1 = timeoutLoops >> 8, t2 = timeoutLoops >> 16;
+  uint8_t found, cnt, tmp, dly;
+  asm volatile (
+    "ldi %[found], 0\n"
+    "1:\n\t"
+    "ld %[tmp], Z\n\t"
+    "and %[tmp], %[mask]\n\t"
+    "brne 2f\n\t"
+    "subi %[t0], 1\n\t"
+    "sbci %[t1], 0\n\t"
+    "sbci %[t2], 0\n\t"
+    "brne 1b\n\t"
+    "rjmp 9f\n"
+    "2:\n\t"
+    "ldi %[found], 1\n\t"
+    "ldi %[cnt], lo8(%[n])\n"
+    "3:\n\t"
+    "ld %[tmp], Z\n\t"
+    "st X+, %[tmp]\n\t"
+    HD_ASM_DELAY("d0")
+    "dec %[cnt]\n\t"
+    "brne 3b\n"
+    "9:\n\t"
+    : [found] "=&d" (found), [cnt] "=&d" (cnt), [tmp] "=&r" (tmp),
+      [dly] "=&d" (dly), [samples] "+x" (samples),
+      [t0] "+d" (t0), [t1] "+d" (t1), [t2] "+d" (t2)
+    : [pin] "z" (pinReg), [mask] "r" (mask),
+      [n] "n" (HD_CAPTURE_SAMPLES),
+      HD_ASM_DELAY_OPERANDS(d0, HD_SAMPLE_CYCLES - 7)
+    : "memory"
+  );
+  return found;
+}
+
+/* Reads one byte. `pinReg` is the PINx register and `mask` selects the pin.
+Polls for the start bit up to `*timeoutLoops` times (see hitecdTimeoutLoops()),
+and leaves the number of polls it didn't use in `*timeoutLoops`, so the caller
+can tell when the start bit arrived. Returns the byte, or HITECD_ERR_NO_SERVO
+on timeout, or HITECD_ERR_CORRUPT if the stop bit is wrong. The caller disables
+interrupts.
+
+Cycle accounting (ld is 2 cycles; each sample happens inside an ld, so the
+position of the sample within the ld cancels out):
+- polling loop: ld, and, brne, subi, sbci, sbci, brne = 9 per iteration. On
+  average the edge happened 4 cycles before the ld that saw it, plus about 1
+  cycle for the pin synchronizer.
+- detection to first data sample: ld, and, brne (taken), ldi, d0 = 6 + d0
+- data sample to data sample: ld, and, cpi, ror, d1, dec, brne = 8 + d1
+- last data sample to stop sample: same, but brne not taken, plus a nop
+
+`cpi tmp, 1` sets the carry flag iff the pin was low (a 1 bit, because of the
+inverted polarity), and `ror` shifts the carry in from the top, so the bits end
+up LSB-first without any branches. */
+static inline int hitecdReadByteExact(
+  volatile uint8_t *pinReg,
+  uint8_t mask,
+  uint32_t *timeoutLoops
+) {
+  uint8_t t0 = *timeoutLoops, t1 = *timeoutLoops >> 8;
+  uint8_t t2 = *timeoutLoops >> 16;
+  uint8_t val = 0, status, cnt, tmp, dly;
+  asm volatile (
+    "1:\n\t"
+    "ld %[tmp], Z\n\t"
+    "and %[tmp], %[mask]\n\t"
+    "brne 2f\n\t"
+    "subi %[t0], 1\n\t"
+    "sbci %[t1], 0\n\t"
+    "sbci %[t2], 0\n\t"
+    "brne 1b\n\t"
+    "ldi %[status], 0xFF\n\t"
+    "rjmp 9f\n"
+    "2:\n\t"
+    "ldi %[cnt], 8\n\t"
+    HD_ASM_DELAY("d0")
+    "3:\n\t"
+    "ld %[tmp], Z\n\t"
+    "and %[tmp], %[mask]\n\t"
+    "cpi %[tmp], 1\n\t"
+    "ror %[val]\n\t"
+    HD_ASM_DELAY("d1")
+    "dec %[cnt]\n\t"
+    "brne 3b\n\t"
+    "nop\n\t"
+    "ld %[status], Z\n\t"
+    "and %[status], %[mask]\n"
+    "9:\n\t"
+    : [val] "+r" (val), [status] "=&d" (status), [cnt] "=&d" (cnt),
+      [tmp] "=&d" (tmp), [dly] "=&d" (dly),
+      [t0] "+d" (t0), [t1] "+d" (t1), [t2] "+d" (t2)
+    : [pin] "z" (pinReg), [mask] "r" (mask),
+      HD_ASM_DELAY_OPERANDS(d0, HD_BIT_CYCLES * 3 / 2 - 11),
+      HD_ASM_DELAY_OPERANDS(d1, HD_BIT_CYCLES - 8)
+    : "memory"
+  );
+  *timeoutLoops = t0 | (uint16_t)t1 << 8 | (uint32_t)t2 << 16;
+  if (status == 0xFF) {
+    return HITECD_ERR_NO_SERVO;
+  } else if (status != 0) {
+    return HITECD_ERR_CORRUPT;
+  }
+  return val;
+}
+
+/* Same as hitecdReadByteExact(), but `pinAddress` is the I/O address of the
+PINx register, known at compile time. (in is 1 cycle.)
+- polling loop: in, and, brne, subi, sbci, sbci, brne = 8 per iteration; on
+  average the edge happened 3.5 cycles before the in that saw it
+- detection to first data sample: in, and, brne (taken), ldi, d0 = 5 + d0
+- data sample to data sample: in, and, cpi, ror, d1, dec, brne = 7 + d1 */
+template<uint8_t pinAddress>
+static inline int hitecdReadByteExactIO(
+  uint8_t mask,
+  uint32_t *timeoutLoops
+) {
+  uint8_t t0 = *timeoutLoops, t1 = *timeoutLoops >> 8;
+  uint8_t t2 = *timeoutLoops >> 16;
+  uint8_t val = 0, status, cnt, tmp, dly;
+  asm volatile (
+    "1:\n\t"
+    "in %[tmp], %[pin]\n\t"
+    "and %[tmp], %[mask]\n\t"
+    "brne 2f\n\t"
+    "subi %[t0], 1\n\t"
+    "sbci %[t1], 0\n\t"
+    "sbci %[t2], 0\n\t"
+    "brne 1b\n\t"
+    "ldi %[status], 0xFF\n\t"
+    "rjmp 9f\n"
+    "2:\n\t"
+    "ldi %[cnt], 8\n\t"
+    HD_ASM_DELAY("d0")
+    "3:\n\t"
+    "in %[tmp], %[pin]\n\t"
+    "and %[tmp], %[mask]\n\t"
+    "cpi %[tmp], 1\n\t"
+    "ror %[val]\n\t"
+    HD_ASM_DELAY("d1")
+    "dec %[cnt]\n\t"
+    "brne 3b\n\t"
+    "nop\n\t"
+    "in %[status], %[pin]\n\t"
+    "and %[status], %[mask]\n"
+    "9:\n\t"
+    : [val] "+r" (val), [status] "=&d" (status), [cnt] "=&d" (cnt),
+      [tmp] "=&d" (tmp), [dly] "=&d" (dly),
+      [t0] "+d" (t0), [t1] "+d" (t1), [t2] "+d" (t2)
+    : [pin] "I" (pinAddress), [mask] "r" (mask),
+      HD_ASM_DELAY_OPERANDS(d0, (HD_BIT_CYCLES * 3 - 19) / 2),
+      HD_ASM_DELAY_OPERANDS(d1, HD_BIT_CYCLES - 7)
+    : "memory"
+  );
+  *timeoutLoops = t0 | (uint16_t)t1 << 8 | (uint32_t)t2 << 16;
+  if (status == 0xFF) {
+    return HITECD_ERR_NO_SERVO;
+  } else if (status != 0) {
+    return HITECD_ERR_CORRUPT;
+  }
+  return val;
+}
+
+#endif /* HitecDServoBitEngine_h */
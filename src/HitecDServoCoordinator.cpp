@@ -0,0 +1,217 @@
+#include "HitecDServoCoordinator.h"
+
+#include "HitecDServoInternal.h"
+
+/* Progress along a move is measured in 1/16384ths, so that the position of
+each servo can be computed with a multiply and a shift. */
+#define HD_COORD_PROGRESS_SHIFT 14
+#define HD_COORD_PROGRESS_MAX (1 << HD_COORD_PROGRESS_SHIFT)
+
+#define HD_COORD_DEFAULT_RATE 200
+
+/* Limits on the progress velocity and acceleration, so that
+HitecDServoTrajectory::setLimits() doesn't overflow. Even the fastest of these
+finishes a move in a fraction of a second. */
+#define HD_COORD_MAX_LIMIT 0x1FFFFFUL
+
+/* Computes a * b / c without overflowing, as long as c * b and a / c * b fit
+in 32 bits. */
+static uint32_t mulDiv(uint32_t a, uint32_t b, uint32_t c) {
+  return a / c * b + a % c * b / c;
+}
+
+HitecDServoCoordinator::HitecDServoCoordinator() :
+  count(0),
+  sameGroup(true),
+  maxVelocityAPV(4000),
+  maxAccelerationAPV(16000),
+  maxJerkAPV(0),
+  ticking(false),
+  lastProgress(HD_COORD_PROGRESS_MAX)
+{
+  setRate(HD_COORD_DEFAULT_RATE);
+  progress.reset(HD_COORD_PROGRESS_MAX);
+}
+
+int HitecDServoCoordinator::add(HitecDServo *servo) {
+  int res;
+
+  if (!servo->attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (count == HITECD_COORDINATOR_MAX) {
+    return HITECD_ERR_GROUP_FULL;
+  }
+
+  HitecDSettings settings;
+  if ((res = servo->readSettings(&settings, HITECD_FIELD_SPEED)) !=
+      HITECD_OK) {
+    return res;
+  }
+  int16_t quarterMicros = servo->readCurrentQuarterMicros();
+  if (quarterMicros < 0) {
+    return quarterMicros;
+  }
+
+  if (sameGroup && group.add(servo) < 0) {
+    sameGroup = false;
+  }
+
+  servos[count] = servo;
+  speeds[count] = settings.speed;
+  starts[count] = current[count] = quarterMicros;
+  deltas[count] = 0;
+  return count++;
+}
+
+uint8_t HitecDServoCoordinator::size() {
+  return count;
+}
+
+void HitecDServoCoordinator::setRate(uint16_t _ticksPerSecond) {
+  ticksPerSecond = _ticksPerSecond;
+  progress.setRate(ticksPerSecond);
+  ticking = false;
+}
+
+void HitecDServoCoordinator::setLimits(
+  uint32_t _maxVelocityAPV,
+  uint32_t _maxAccelerationAPV,
+  uint32_t _maxJerkAPV
+) {
+  maxVelocityAPV = _maxVelocityAPV;
+  maxAccelerationAPV = _maxAccelerationAPV;
+  maxJerkAPV = _maxJerkAPV;
+}
+
+void HitecDServoCoordinator::moveTo(const int16_t *goalQuarterMicros) {
+  /* Work out how fast progress can go without any servo exceeding its limits.
+  A servo moving `delta` quarter-micros goes delta / HD_COORD_PROGRESS_MAX
+  quarter-micros per unit of progress. */
+  uint32_t velocity = 0xFFFFFFFF, acceleration = 0xFFFFFFFF;
+  for (uint8_t i = 0; i < count; ++i) {
+    starts[i] = current[i];
+    deltas[i] = goalQuarterMicros[i] - current[i];
+    if (deltas[i] == 0) {
+      continue;
+    }
+    uint16_t absDelta = abs(deltas[i]);
+
+    /* Convert the limits from APV to quarter-micros. The range maps 850us to
+    2150us (5200 quarter-micros) onto rangeLeftAPV to rangeRightAPV. */
+    HitecDServo *servo = servos[i];
+    uint32_t spanAPV = abs(servo->rangeRightAPV - servo->rangeLeftAPV);
+    if (spanAPV == 0) {
+      spanAPV = 1;
+    }
+    uint32_t speed = speeds[i] > 0 ? speeds[i] : 100;
+    uint32_t servoVelocity = mulDiv(
+      maxVelocityAPV * speed / 100, 4 * (2150 - 850), spanAPV);
+    uint32_t servoAcceleration = mulDiv(
+      maxAccelerationAPV, 4 * (2150 - 850), spanAPV);
+
+    uint32_t v = mulDiv(servoVelocity, HD_COORD_PROGRESS_MAX, absDelta);
+    if (v < velocity) {
+      velocity = v;
+    }
+    uint32_t a = mulDiv(servoAcceleration, HD_COORD_PROGRESS_MAX, absDelta);
+    if (a < acceleration) {
+      acceleration = a;
+    }
+  }
+
+  if (velocity == 0xFFFFFFFF) {
+    /* Nothing to move */
+    progress.reset(HD_COORD_PROGRESS_MAX);
+    lastProgress = HD_COORD_PROGRESS_MAX;
+    return;
+  }
+  if (velocity > HD_COORD_MAX_LIMIT) {
+    velocity = HD_COORD_MAX_LIMIT;
+  }
+  if (acceleration > HD_COORD_MAX_LIMIT) {
+    acceleration = HD_COORD_MAX_LIMIT;
+  }
+
+  /* The jerk limit only sets how long the acceleration takes to ramp up, which
+  is the same in any units, so keep its ratio to the acceleration. */
+  uint32_t jerk = 0;
+  if (maxJerkAPV != 0 && maxAccelerationAPV != 0) {
+    uint64_t scaled = (uint64_t)acceleration * maxJerkAPV / maxAccelerationAPV;
+    jerk = scaled > 0xFFFFFFFFUL ? 0xFFFFFFFFUL : (uint32_t)scaled;
+    if (jerk == 0) {
+      jerk = 1;
+    }
+  }
+  progress.setLimits(velocity, acceleration, jerk);
+  progress.reset(0);
+  progress.moveTo(HD_COORD_PROGRESS_MAX);
+  lastProgress = -1;
+}
+
+bool HitecDServoCoordinator::done() {
+  return lastProgress == HD_COORD_PROGRESS_MAX;
+}
+
+int HitecDServoCoordinator::update() {
+  if (done()) {
+    return HITECD_PENDING;
+  }
+
+  unsigned long now = micros();
+  unsigned long periodMicros = 1000000UL / ticksPerSecond;
+  if (!ticking) {
+    ticking = true;
+    nextTickMicros = now;
+  }
+  if ((long)(now - nextTickMicros) < 0) {
+    return HITECD_PENDING;
+  }
+  nextTickMicros += periodMicros;
+  if ((long)(now - nextTickMicros) >= 0) {
+    nextTickMicros = now + periodMicros;
+  }
+
+  for (uint8_t i = 0; i < count; ++i) {
+    if (servos[i]->readState != HD_READ_IDLE) {
+      return HITECD_ERR_BUSY;
+    }
+  }
+
+  /* Progress must stay within [0, 1] or servos run past their targets. */
+  int16_t p = progress.step();
+  if (p < 0) {
+    p = 0;
+  } else if (p > HD_COORD_PROGRESS_MAX) {
+    p = HD_COORD_PROGRESS_MAX;
+  }
+  if (p == lastProgress) {
+    return HITECD_PENDING;
+  }
+  lastProgress = p;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    current[i] = starts[i] +
+      (int16_t)(((int32_t)deltas[i] * p) >> HD_COORD_PROGRESS_SHIFT);
+  }
+  writeTargets(current);
+  return HITECD_OK;
+}
+
+void HitecDServoCoordinator::writeTargets(const int16_t *quarterMicros) {
+  if (sameGroup) {
+    group.writeTargetQuarterMicros(quarterMicros);
+    return;
+  }
+
+  /* Unlike HitecDServo::writeTargetQuarterMicros(), don't wait between
+  frames; the gap is only needed between frames to the same servo. */
+  for (uint8_t i = 0; i < count; ++i) {
+    uint16_t val = constrain(quarterMicros[i], 4*850, 4*2150) - 3000;
+    uint8_t low = val & 0xFF;
+    uint8_t high = (val >> 8) & 0xFF;
+    uint8_t checksum = (0x00 + HD_REG_TARGET + 0x02 + low + high) & 0xFF;
+    uint8_t frame[7] = {0x96, 0x00, HD_REG_TARGET, 0x02, low, high, checksum};
+    servos[i]->writeFrame(frame, sizeof(frame));
+  }
+}
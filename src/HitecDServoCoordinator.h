@@ -0,0 +1,109 @@
+#ifndef HitecDServoCoordinator_h
+#define HitecDServoCoordinator_h
+
+#include "HitecDServo.h"
+#include "HitecDServoGroup.h"
+#include "HitecDServoTrajectory.h"
+
+/* The maximum number of servos in a HitecDServoCoordinator */
+#define HITECD_COORDINATOR_MAX 8
+
+/* HitecDServoCoordinator moves several servos together, so that they all start
+on the same tick and arrive at the same time, and the path between the start
+and the goal is a straight line (in quarter-microseconds). It works like
+HitecDServoTrajectory, except that a single profile is shared by all the
+servos, and it's slowed down to suit whichever servo has the furthest to go.
+
+The limits are in APV units (see HitecDSettings), so they mean the same thing
+for every servo no matter how its range is set. Each servo's maximum velocity
+is also scaled by its speed setting, because the servo won't move faster than
+that anyway.
+
+If all the servos are on pins of the same port, each tick's targets are sent
+to all of them at once using a HitecDServoGroup. Otherwise they're sent one
+after another with no gaps in between, so the last servo gets its target about
+610us after the first one for each servo in between.
+
+Example usage:
+    HitecDServo pan, tilt;
+    HitecDServoCoordinator coordinator;
+    ...
+    coordinator.add(&pan);
+    coordinator.add(&tilt);
+    coordinator.setLimits(4000, 16000);
+    ...
+    int16_t goals[2] = {4*1200, 4*1800};
+    coordinator.moveTo(goals);
+    while (!coordinator.done()) {
+      coordinator.update();
+      (do something else)
+    }
+
+While the coordinator is moving the servos, don't write their targets
+directly. */
+class HitecDServoCoordinator {
+public:
+  HitecDServoCoordinator();
+
+  /* Adds an attached servo. This reads the servo's speed setting and current
+  position. Returns the servo's index within the coordinator (0 for the first
+  servo added, and so on), or an error code:
+  - HITECD_ERR_NOT_ATTACHED if the servo isn't attached.
+  - HITECD_ERR_GROUP_FULL if the coordinator already has
+    HITECD_COORDINATOR_MAX servos.
+  - Any error from reading the servo. */
+  int add(HitecDServo *servo);
+
+  /* Number of servos in the coordinator */
+  uint8_t size();
+
+  /* See HitecDServoTrajectory::setRate(). */
+  void setRate(uint16_t ticksPerSecond);
+
+  /* Sets the maximum velocity, acceleration, and (optionally) jerk of each
+  servo, in APV units per second (per second, per second). These apply to the
+  next moveTo(). */
+  void setLimits(uint32_t maxVelocityAPV, uint32_t maxAccelerationAPV,
+    uint32_t maxJerkAPV = 0);
+
+  /* Plans a move from the current positions to the given ones;
+  `goalQuarterMicros[i]` is for the servo with index i. The move starts on the
+  next call to update(). Calling this in the middle of a move starts a new move
+  from wherever the servos have got to. */
+  void moveTo(const int16_t *goalQuarterMicros);
+
+  /* Returns whether the last move has finished. */
+  bool done();
+
+  /* If it's time for the next tick, writes the next targets to all the servos.
+  Returns HITECD_OK if it wrote them, HITECD_PENDING if it wasn't time yet (or
+  there's nothing to do), or HITECD_ERR_BUSY if one of the servos is in the
+  middle of a non-blocking read. */
+  int update();
+
+private:
+  void writeTargets(const int16_t *quarterMicros);
+
+  HitecDServo *servos[HITECD_COORDINATOR_MAX];
+  uint8_t count;
+
+  /* Used if all the servos are on the same port */
+  HitecDServoGroup group;
+  bool sameGroup;
+
+  int8_t speeds[HITECD_COORDINATOR_MAX];
+  int16_t starts[HITECD_COORDINATOR_MAX];
+  int16_t deltas[HITECD_COORDINATOR_MAX];
+  int16_t current[HITECD_COORDINATOR_MAX];
+
+  uint32_t maxVelocityAPV, maxAccelerationAPV, maxJerkAPV;
+
+  /* Progress along the move, in 1/16384ths */
+  HitecDServoTrajectory progress;
+  uint16_t ticksPerSecond;
+  unsigned long nextTickMicros;
+  bool ticking;
+  int16_t lastProgress;
+};
+
+#endif /* HitecDServoCoordinator_h */
@@ -0,0 +1,107 @@
+#include "HitecDServo.h"
+
+#include <avr/eeprom.h>
+#include <stddef.h>
+
+#include "HitecDServoInternal.h"
+
+static_assert(sizeof(HitecDEEPROMRecord) <= HITECD_EEPROM_SLOT_LEN,
+  "HitecDEEPROMRecord doesn't fit in HITECD_EEPROM_SLOT_LEN");
+
+static uint8_t recordChecksum(const HitecDEEPROMRecord &record) {
+  const uint8_t *bytes = (const uint8_t *)&record;
+  uint8_t sum = 1;
+  for (uint8_t i = 0; i < offsetof(HitecDEEPROMRecord, checksum); ++i) {
+    sum += bytes[i];
+  }
+  return sum;
+}
+
+static uint8_t *slotAddress(uint16_t eepromAddress, uint8_t slot) {
+  return (uint8_t *)(uintptr_t)(eepromAddress + slot * HITECD_EEPROM_SLOT_LEN);
+}
+
+void HitecDServo::useSettingsEEPROM(
+  uint16_t _eepromAddress,
+  uint8_t numSlots
+) {
+  eepromAddress = _eepromAddress;
+  eepromNumSlots = numSlots;
+  eepromSlot = -1;
+  eepromValid = false;
+}
+
+int HitecDServo::forgetSettingsEEPROM() {
+  invalidateEEPROMSettings();
+  if (!attached()) {
+    return HITECD_OK;
+  }
+  /* attach() may have taken the range from the stale record */
+  return readRange();
+}
+
+bool HitecDServo::loadEEPROMSettings(HitecDSettings *settingsOut) {
+  HitecDEEPROMRecord record;
+  for (uint8_t i = 0; i < eepromNumSlots; ++i) {
+    if (eepromSlot >= 0 && i != eepromSlot) {
+      continue;
+    }
+    eeprom_read_block(&record, slotAddress(eepromAddress, i), sizeof(record));
+    if (record.magic != HD_EEPROM_VALID && record.magic != HD_EEPROM_STALE) {
+      continue;
+    }
+    if (record.fingerprint != fingerprint ||
+        record.modelNumber != (uint16_t)modelNumber) {
+      continue;
+    }
+    eepromSlot = i;
+    eepromValid = record.magic == HD_EEPROM_VALID &&
+      record.checksum == recordChecksum(record);
+    if (eepromValid) {
+      *settingsOut = record.settings;
+    }
+    return eepromValid;
+  }
+  return false;
+}
+
+void HitecDServo::storeEEPROMSettings(const HitecDSettings &settings) {
+  if (eepromNumSlots == 0) {
+    return;
+  }
+
+  /* Use this servo's slot if it has one, or else an unused slot, or else
+  evict whichever servo the fingerprint picks. */
+  if (eepromSlot < 0) {
+    for (uint8_t i = 0; i < eepromNumSlots; ++i) {
+      uint8_t magic = eeprom_read_byte(slotAddress(eepromAddress, i));
+      if (magic != HD_EEPROM_VALID && magic != HD_EEPROM_STALE) {
+        eepromSlot = i;
+        break;
+      }
+    }
+    if (eepromSlot < 0) {
+      eepromSlot = fingerprint % eepromNumSlots;
+    }
+  }
+
+  HitecDEEPROMRecord record;
+  record.magic = HD_EEPROM_VALID;
+  record.fingerprint = fingerprint;
+  record.modelNumber = modelNumber;
+  record.settings = settings;
+  record.checksum = recordChecksum(record);
+
+  /* eeprom_update_block() skips bytes that haven't changed, to save wear. */
+  eeprom_update_block(&record, slotAddress(eepromAddress, eepromSlot),
+    sizeof(record));
+  eepromValid = true;
+}
+
+void HitecDServo::invalidateEEPROMSettings() {
+  if (!eepromValid) {
+    return;
+  }
+  eeprom_update_byte(slotAddress(eepromAddress, eepromSlot), HD_EEPROM_STALE);
+  eepromValid = false;
+}
@@ -0,0 +1,279 @@
+#include "HitecDServoGroup.h"
+
+#include "HitecDServoInternal.h"
+#include "HitecDServoBitEngine.h"
+#include "HitecDServoTimer.h"
+
+/* Transposes a frame into "slots": slot k holds the level of every servo's pin
+during bit period k, and this sets the bits in `mask` for the slots where the
+frame is high. Each byte takes 10 bit periods (start bit, 8 data bits
+LSB-first, stop bit), and the polarity is inverted: the start bit is high, 1
+bits are low, and the stop bit is low. */
+static void addFrameToSlots(
+  uint8_t *slots,
+  const uint8_t *frame,
+  uint8_t len,
+  uint8_t mask
+) {
+  for (uint8_t b = 0; b < len; ++b) {
+    uint8_t *byteSlots = slots + b * 10;
+    byteSlots[0] |= mask;
+    for (uint8_t j = 0; j < 8; ++j) {
+      if (!(frame[b] & (1 << j))) {
+        byteSlots[j + 1] |= mask;
+      }
+    }
+  }
+}
+
+/* Decodes a 7-byte response from one pin of a capture made by
+hitecdCaptureExact(). Each byte is located by searching for its start bit, so
+the servos don't need to respond at exactly the same time, and small errors in
+our sample rate don't accumulate from byte to byte. */
+static int decodeCapture(
+  const uint8_t *samples,
+  uint8_t mask,
+  uint8_t *response
+) {
+  /* Samples per bit, as an 8.8 fixed-point number (about 3.0) */
+  const uint16_t samplesPerBit = HD_BIT_CYCLES * 256L / HD_SAMPLE_CYCLES;
+
+  uint16_t pos = 0;
+  for (uint8_t b = 0; b < 7; ++b) {
+    while (pos < HD_CAPTURE_SAMPLES && !(samples[pos] & mask)) {
+      ++pos;
+    }
+
+    /* The edge happened somewhere between samples pos-1 and pos. Bit k is
+    centered (k + 0.5) bit periods after the edge; with the edge at pos-0.5,
+    that rounds to pos + floor((2k + 1) * samplesPerBit / 512). */
+    uint8_t val = 0;
+    for (uint8_t k = 0; k < 10; ++k) {
+      uint16_t i = pos + (((2 * k + 1) * samplesPerBit) >> 9);
+      if (i >= HD_CAPTURE_SAMPLES) {
+        return HITECD_ERR_CORRUPT;
+      }
+      bool high = samples[i] & mask;
+      if (k == 0) {
+        /* Start bit should be high, unless this was a glitch */
+        if (!high) return HITECD_ERR_CORRUPT;
+      } else if (k == 9) {
+        /* Stop bit should be low */
+        if (high) return HITECD_ERR_CORRUPT;
+        pos = i + 1;
+      } else if (!high) {
+        val |= 1 << (k - 1);
+      }
+    }
+    response[b] = val;
+  }
+  return HITECD_OK;
+}
+
+HitecDServoGroup::HitecDServoGroup() :
+  count(0),
+  pinMask(0)
+{ }
+
+int HitecDServoGroup::add(HitecDServo *servo) {
+  if (!servo->attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (count == HITECD_GROUP_MAX) {
+    return HITECD_ERR_GROUP_FULL;
+  }
+  if (count == 0) {
+    inputRegister = servo->pinInputRegister;
+    outputRegister = servo->pinOutputRegister;
+  } else if (servo->pinOutputRegister != outputRegister) {
+    return HITECD_ERR_WRONG_PORT;
+  }
+  /* This also catches the same servo being added twice. */
+  if (pinMask & servo->pinBitMask) {
+    return HITECD_ERR_SAME_PIN;
+  }
+  servos[count] = servo;
+  pinMask |= servo->pinBitMask;
+  return count++;
+}
+
+uint8_t HitecDServoGroup::size() {
+  return count;
+}
+
+int HitecDServoGroup::writeTargetQuarterMicros(const int16_t *quarterMicros) {
+  uint16_t vals[HITECD_GROUP_MAX];
+  for (uint8_t i = 0; i < count; ++i) {
+    vals[i] = constrain(quarterMicros[i], 4*850, 4*2150) - 3000;
+  }
+  return writeRawRegisters(HD_REG_TARGET, vals);
+}
+
+int HitecDServoGroup::readCurrentAPVs(int16_t *apvsOut) {
+  uint16_t vals[HITECD_GROUP_MAX];
+  int results[HITECD_GROUP_MAX];
+  int res = readRawRegisters(HD_REG_CURRENT_APV, vals, results);
+  if (res != HITECD_OK) {
+    return res;
+  }
+  for (uint8_t i = 0; i < count; ++i) {
+    apvsOut[i] = (results[i] == HITECD_OK) ? (int16_t)vals[i] : results[i];
+  }
+  return HITECD_OK;
+}
+
+int HitecDServoGroup::writeRawRegisters(uint8_t reg, const uint16_t *vals) {
+  for (uint8_t i = 0; i < count; ++i) {
+    if (servos[i]->readState != HD_READ_IDLE) {
+      return HITECD_ERR_BUSY;
+    }
+  }
+
+  /* Each servo gets its own frame, because the values (and therefore the
+  checksums) differ. */
+  uint8_t slots[7 * 10];
+  memset(slots, 0, sizeof(slots));
+  for (uint8_t i = 0; i < count; ++i) {
+    uint8_t low = vals[i] & 0xFF;
+    uint8_t high = (vals[i] >> 8) & 0xFF;
+    uint8_t checksum = (0x00 + reg + 0x02 + low + high) & 0xFF;
+    uint8_t frame[7] = {0x96, 0x00, reg, 0x02, low, high, checksum};
+    addFrameToSlots(slots, frame, sizeof(frame), servos[i]->pinBitMask);
+  }
+
+  writeSlots(slots, sizeof(slots));
+
+  delay(1);
+  return HITECD_OK;
+}
+
+int HitecDServoGroup::readRawRegisters(
+  uint8_t reg,
+  uint16_t *valsOut,
+  int *resultsOut
+) {
+  if (count == 0) {
+    return HITECD_OK;
+  }
+  for (uint8_t i = 0; i < count; ++i) {
+    if (servos[i]->readState != HD_READ_IDLE) {
+      return HITECD_ERR_BUSY;
+    }
+  }
+
+  /* Every servo gets the same request, so all the pins move together. The
+  timing below follows HitecDServo::pollReadRawRegister(); see there for
+  details. */
+  uint8_t checksum = (0x00 + reg + 0x00) & 0xFF;
+  uint8_t frame[5] = {0x96, 0x00, reg, 0x00, checksum};
+  uint8_t slots[5 * 10];
+  memset(slots, 0, sizeof(slots));
+  addFrameToSlots(slots, frame, sizeof(frame), pinMask);
+  writeSlots(slots, sizeof(slots));
+  unsigned long startMicros = micros();
+
+  while (micros() - startMicros < HD_READ_RELEASE_US) { }
+  for (uint8_t i = 0; i < count; ++i) {
+    pinMode(servos[i]->pin, INPUT_PULLUP);
+  }
+
+  /* Servos that aren't pulling their pin low aren't there. Drive their pins
+  low again, and leave them out of the capture. */
+  uint8_t listenMask = pinMask;
+  uint8_t levels = *inputRegister;
+  for (uint8_t i = 0; i < count; ++i) {
+    resultsOut[i] = HITECD_OK;
+    if (levels & servos[i]->pinBitMask) {
+      pinMode(servos[i]->pin, OUTPUT);
+      digitalWrite(servos[i]->pin, LOW);
+      resultsOut[i] = HITECD_ERR_NO_SERVO;
+      listenMask &= ~servos[i]->pinBitMask;
+    }
+  }
+
+  /* Listen from the earliest any servo might respond until the latest. Once
+  the servos' latencies have been measured (attach() does that), this is much
+  shorter than the uncalibrated window, which keeps interrupts off for less
+  time. */
+  unsigned long windowStart = 0, windowEnd = 0;
+  bool first = true;
+  for (uint8_t i = 0; i < count; ++i) {
+    HitecDServo *servo = servos[i];
+    if (!(listenMask & servo->pinBitMask)) {
+      continue;
+    }
+    unsigned long start = servo->responseWindowStart();
+    unsigned long end = start + servo->responseWindowLength();
+    if (first || start < windowStart) {
+      windowStart = start;
+    }
+    if (first || end > windowEnd) {
+      windowEnd = end;
+    }
+    first = false;
+  }
+
+  /* The capture starts at the first start bit from any servo, and lasts about
+  85 bit periods; a response is 70 bit periods, so the other servos can start
+  responding up to about 130us later and still be captured. */
+  uint8_t samples[HD_CAPTURE_SAMPLES];
+  bool captured = false;
+  if (listenMask != 0) {
+    uint32_t timeoutLoops = hitecdTimeoutLoops(windowEnd - windowStart,
+      HD_WAIT_LOOP_CYCLES);
+    while (micros() - startMicros < windowStart) { }
+    uint8_t oldSREG = SREG;
+    cli();
+    captured = hitecdCaptureExact(inputRegister, listenMask, samples,
+      timeoutLoops);
+    SREG = oldSREG;
+    delay(1);
+  }
+
+  for (uint8_t i = 0; i < count; ++i) {
+    HitecDServo *servo = servos[i];
+    if (resultsOut[i] != HITECD_OK) {
+      continue;
+    }
+
+    /* Same check as HitecDServo::pollReadRawRegister() makes after the
+    response. */
+    if (digitalRead(servo->pin) != HIGH) {
+      resultsOut[i] = HITECD_ERR_BOOTING_OR_NO_PULLUP;
+    }
+    pinMode(servo->pin, OUTPUT);
+    digitalWrite(servo->pin, LOW);
+    if (resultsOut[i] != HITECD_OK) {
+      continue;
+    }
+
+    uint8_t response[7];
+    if (!captured) {
+      resultsOut[i] = HITECD_ERR_CORRUPT;
+    } else if ((resultsOut[i] = decodeCapture(samples, servo->pinBitMask,
+        response)) == HITECD_OK) {
+      servo->readReg = reg;
+      if ((resultsOut[i] = servo->parseResponse(response)) == HITECD_OK) {
+        valsOut[i] = servo->readValue;
+      }
+    }
+  }
+
+  delay(1);
+  return HITECD_OK;
+}
+
+void HitecDServoGroup::writeSlots(const uint8_t *slots, uint8_t len) {
+  /* Don't interfere with a frame that the timer is still sending. */
+  while (hitecdTimerBusy) { }
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  /* Read the rest of the port with interrupts disabled, so that we don't
+  clobber a change made by an interrupt handler. */
+  uint8_t base = *outputRegister & ~pinMask;
+  hitecdWriteSlotsExact(outputRegister, base, slots, len);
+
+  SREG = oldSREG;
+}
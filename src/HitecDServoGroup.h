@@ -0,0 +1,79 @@
+#ifndef HitecDServoGroup_h
+#define HitecDServoGroup_h
+
+#include "HitecDServo.h"
+
+/* The maximum number of servos in a HitecDServoGroup. All the servos in a group
+must be on pins of the same port, and a port has 8 pins. */
+#define HITECD_GROUP_MAX 8
+
+/* HitecDServoGroup talks to several servos at once, as long as they're all
+wired to pins on the same AVR port (for example, pins 2-7 on an Arduino Uno are
+all on PORTD). Each bit of the serial protocol is sent to every servo in the
+group with a single write to the port register, so updating the targets of 8
+servos takes about 610us, the same as updating one. Likewise, their positions
+can be read in parallel.
+
+Example usage:
+    HitecDServo servo1, servo2;
+    HitecDServoGroup group;
+    ...
+    servo1.attach(2);
+    servo2.attach(3);
+    group.add(&servo1);
+    group.add(&servo2);
+    ...
+    int16_t targets[2] = {4*1200, 4*1800};
+    group.writeTargetQuarterMicros(targets);
+
+The servos are still ordinary HitecDServo objects, and can be used individually
+too. The group doesn't use the interrupt-driven engines, even if they're enabled
+for the servos. */
+class HitecDServoGroup {
+public:
+  HitecDServoGroup();
+
+  /* Adds an attached servo to the group. Returns the servo's index within the
+  group (0 for the first servo added, and so on), or an error code:
+  - HITECD_ERR_NOT_ATTACHED if the servo isn't attached.
+  - HITECD_ERR_WRONG_PORT if the servo's pin isn't on the same port as the
+    servos already in the group.
+  - HITECD_ERR_GROUP_FULL if the group already has HITECD_GROUP_MAX servos.
+  - HITECD_ERR_SAME_PIN if the group already has this servo, or another servo
+    on the same pin. */
+  int add(HitecDServo *servo);
+
+  /* Number of servos in the group */
+  uint8_t size();
+
+  /* Writes a different target to each servo; `quarterMicros[i]` is for the
+  servo with index i. See HitecDServo::writeTargetQuarterMicros(). Returns
+  HITECD_OK, or HITECD_ERR_BUSY if one of the servos is in the middle of a
+  non-blocking read. */
+  int writeTargetQuarterMicros(const int16_t *quarterMicros);
+
+  /* Reads the current position of every servo at once, which takes about 17ms
+  in total, the same as reading one servo. `apvsOut[i]` is set to the current
+  APV of the servo with index i (see HitecDServo::readCurrentAPV()), or to a
+  negative error code if that servo's response was missing or corrupt. Returns
+  HITECD_OK, or HITECD_ERR_BUSY if one of the servos is in the middle of a
+  non-blocking read.
+
+  Interrupts are disabled while the responses are received: for about 1ms once
+  the servos' response latency has been measured (see
+  HitecDServo::getLatencyStats(); attach() measures it), and for up to about
+  1.5ms if it hasn't. This needs a 256-byte buffer on the stack. */
+  int readCurrentAPVs(int16_t *apvsOut);
+
+private:
+  int writeRawRegisters(uint8_t reg, const uint16_t *vals);
+  int readRawRegisters(uint8_t reg, uint16_t *valsOut, int *resultsOut);
+  void writeSlots(const uint8_t *slots, uint8_t len);
+
+  HitecDServo *servos[HITECD_GROUP_MAX];
+  uint8_t count;
+  uint8_t pinMask;
+  volatile uint8_t *inputRegister, *outputRegister;
+};
+
+#endif /* HitecDServoGroup_h */
@@ -1,6 +1,10 @@
 #ifndef HitecDServoInternal_h
 #define HitecDServoInternal_h
 
+#include <Arduino.h>
+
+#include "HitecDServo.h"
+
 /* The servo and programmer communicate via a proprietary serial protocol. This
 header file contains "lab notes" from reverse-engineering communications between
 a Hitec DPC-11 serial programmer and a D485HW servo, mixed with #define'd
@@ -103,6 +107,79 @@ However, the reverse is not true; if the servo receives PWM pulses, followed by
 a serial command, it will respect the serial command as normal.
 */
 
+/* Timing of a register read, measured from the end of the programmer's
+transmission (see "Reading a register" above). We release the line at
+READ_RELEASE_US, and the servo's response begins at READ_RESPONSE_US and
+lasts about READ_RESPONSE_LEN_US (7 bytes at 115200 baud, plus a little slack).
+We start listening READ_RESPONSE_GUARD_US early, in case the servo's clock is a
+bit fast. */
+#define HD_READ_RELEASE_US 14000
+#define HD_READ_RESPONSE_US 15200
+#define HD_READ_RESPONSE_LEN_US 700
+#define HD_READ_RESPONSE_GUARD_US 400
+
+/* How long it takes to send a read request (5 bytes at 115200 baud, plus a
+little slack) */
+#define HD_READ_REQUEST_LEN_US 450
+
+/* How often pollReadRawRegister() is called, at worst */
+#define HD_READ_POLL_INTERVAL_US 1000
+
+/* After the response, the servo should release the line. We check for that
+READ_RELEASED_CHECK_US after receiving the last byte (which is long enough for
+its stop bit to end), and keep checking for up to READ_RELEASED_TIMEOUT_US
+before giving up. While it responds, the servo drives the line low for each
+stop bit and between bytes (the line idles low; see "Fundamentals" above), and
+it stops driving the line once the last stop bit ends (see "Reading a register"
+above), so unless something is wrong the pullup has pulled the line high by the
+first check. */
+#define HD_READ_RELEASED_CHECK_US 100
+#define HD_READ_RELEASED_TIMEOUT_US 1000
+
+/* After a read, we drive the line low for READ_COOLDOWN_US before the next
+request. Within readRawRegisters(), we only wait READ_BATCH_GAP_US between
+reads; the servo has already released the line by then (we check for that at
+the end of each read). READ_BATCH_GAP_US isn't a measured minimum; it's just
+comfortably longer than a bit period (8.7us), so that the servo sees the line go
+low before the next request's start bit. */
+#define HD_READ_COOLDOWN_US 1000
+#define HD_READ_BATCH_GAP_US 200
+
+/* The shortest time from the start of one read request to the start of the
+next, within readRawRegisters(). Each wait that ends in a poll can add up to
+READ_POLL_INTERVAL_US on top of this. */
+#define HD_READ_CYCLE_US (HD_READ_REQUEST_LEN_US + HD_READ_RESPONSE_US + \
+  HD_READ_RESPONSE_LEN_US + HD_READ_RELEASED_CHECK_US + HD_READ_BATCH_GAP_US)
+
+/* waitUntilReady() waits up to BOOT_START_MS for a servo that was just told to
+reboot to start driving the line low, and then considers it ready once the line
+has been high for READY_DEBOUNCE_US. writeSettings() with
+HITECD_WRITE_WAIT_UNTIL_READY gives up after BOOT_TIMEOUT_MS. */
+#define HD_BOOT_START_MS 20
+#define HD_READY_DEBOUNCE_US 500
+#define HD_BOOT_TIMEOUT_MS 1500
+
+/* States for the non-blocking read state machine (HitecDServo::readState) */
+#define HD_READ_IDLE 0
+#define HD_READ_WAIT_RELEASE 1
+#define HD_READ_WAIT_RESPONSE 2
+#define HD_READ_RECEIVING 3
+#define HD_READ_WAIT_RELEASED 4
+#define HD_READ_COOLDOWN 5
+
+/* States for beginWaitForMoveComplete() (HitecDServo::moveState) */
+#define HD_MOVE_IDLE 0
+#define HD_MOVE_READ_VELOCITY 1
+#define HD_MOVE_READ_TRACKING_ERROR 2
+
+/* Once the servo's response latency has been measured (see
+HitecDLatencyStats), we only start listening READ_CALIBRATED_GUARD_US before
+the response is due. */
+#define HD_READ_CALIBRATED_GUARD_US 100
+
+/* Within a response, how long we wait for the next byte's start bit */
+#define HD_READ_BYTE_GAP_TIMEOUT_US 200
+
 /*
 Registers for settings
 ======================
@@ -202,6 +279,53 @@ Other important registers
 #define HD_MODEL_NUMBER_D485HW 485
 #define HD_MODEL_NUMBER_D645MW 34645
 
+/* Per-model constants, stored in a table in HitecDServoModels.cpp. The range
+fields are in APV units, or -1 if unknown; the widest right and center ranges
+follow from widestRangeLeftAPV (see HitecDSettings). ss{Enable,Disable}{1,2}
+are the values of the read-only SS_{ENABLE,DISABLE}_{1,2} registers, so we
+don't need to read them from servos of known models. */
+struct HitecDModelProfile {
+  uint16_t modelNumber;
+  uint8_t flags;
+  int16_t defaultRangeLeftAPV;
+  int16_t defaultRangeRightAPV;
+  int16_t defaultRangeCenterAPV;
+  int16_t widestRangeLeftAPV;
+  uint16_t ssEnable1, ssEnable2, ssDisable1, ssDisable2;
+};
+
+/* Flag for models that are fully supported (see isModelSupported()) */
+#define HD_MODEL_SUPPORTED 0x01
+
+/* Looks up the profile for the given model. Returns false if the model isn't
+in the table. */
+bool hitecdFindModelProfile(int modelNumber, HitecDModelProfile *profileOut);
+
+/* The DPC-11 reads FINGERPRINT at the same time as MODEL_NUMBER and register
+0x04. It seems to always return a constant value for each servo, but that
+constant differs between different servos of the same model, even when reset to
+factory settings. The values were typically around 19000 for the D485HWs I
+tested, and 58 for the D645MW. So we use it to tell servos apart (see
+HitecDServo::useSettingsEEPROM()), although two servos could well have the same
+value. */
+#define HD_REG_FINGERPRINT 0x06
+
+/* Layout of one slot of the EEPROM settings cache (see
+HitecDServo::useSettingsEEPROM()). `magic` is HD_EEPROM_VALID if `settings`
+is up to date, or HD_EEPROM_STALE if the servo's settings have been changed
+since; either way, the slot belongs to the servo with that fingerprint and
+model. `checksum` is the sum of the preceding bytes, plus 1. */
+struct HitecDEEPROMRecord {
+  uint8_t magic;
+  uint16_t fingerprint;
+  uint16_t modelNumber;
+  HitecDSettings settings;
+  uint8_t checksum;
+};
+
+#define HD_EEPROM_VALID 0x5A
+#define HD_EEPROM_STALE 0x00
+
 /* Writing SAVE=SAVE_CONST instructs the servo to flush settings from SRAM to
 EEPROM. If settings are not saved to EEPROM, they will be lost when the servo
 loses power or the REBOOT register is written. */
@@ -233,6 +357,37 @@ value seems to be denominated in APV units. */
 an explanation of what "APV" means. */
 #define HD_REG_CURRENT_APV 0x0C
 
+/* Live registers read by readTelemetry(). What they mean is mostly guesswork;
+these are rough notes about how they appear to behave.
+- VELOCITY and VELOCITY_2: Signed integers. Typically 0, 1, or -1 when the
+  servo is stationary; larger values when moving. Perhaps time-derivatives of
+  CURRENT_APV?
+- MOTOR_POWER: The actual motor power, in the same units as POWER_LIMIT. Reads
+  0 if the motor is off, otherwise proportional to how much power the motor is
+  exerting. Signed integer. If the motor is stalled, then
+  abs(MOTOR_POWER)=EFFECTIVE_POWER_LIMIT.
+- EFFECTIVE_POWER_LIMIT: In normal operation, this is the same as the
+  POWER_LIMIT register, but capped at 2000. If overload protection kicks in,
+  this is reduced by the overload protection amount. (For example, if
+  POWER_LIMIT=1600 and OVERLOAD_PROTECTION=50, and then overload protection
+  kicks in, then EFFECTIVE_POWER_LIMIT will read 800.) Strangely, the DPC-11
+  writes 0x1000 to this register after any time it changes the DIRECTION or
+  RANGE_*_APV registers; after changing the ID register; and when it first
+  connects to the servo. This has no apparent effect; reading it back always
+  returns the effective power limit.
+- TARGET_APV: When the TARGET register is written, this appears to be set to
+  the target point as measured in APV units.
+- TRACKING_ERROR: Might be the difference between CURRENT_APV and TARGET_APV?
+- TRAVEL_DIRECTION: Appears to always read 0x0000 when the servo is traveling
+  to higher APVs, and 0xFFFF when the servo is traveling to lower APVs. */
+#define HD_REG_VELOCITY 0x0E
+#define HD_REG_VELOCITY_2 0xDE
+#define HD_REG_MOTOR_POWER 0x10
+#define HD_REG_EFFECTIVE_POWER_LIMIT 0x22
+#define HD_REG_TARGET_APV 0xE4
+#define HD_REG_TRACKING_ERROR 0xEA
+#define HD_REG_TRAVEL_DIRECTION 0xEC
+
 /* The DPC-11 always writes MYSTERY_OP1=MYSTERY_OP1_CONST and
 MYSTERY_OP2=MYSTERY_OP2_CONST whenever it changes the OVERLOAD_PROTECTION
 setting or resets the servo. I don't know why; perhaps they configure
@@ -250,6 +405,99 @@ to the deadband somehow.) */
 #define HD_REG_MYSTERY_DB 0x72
 #define HD_MYSTERY_DB_CONST 0x4E54
 
+/* How each HitecDSettings field maps onto the servo's registers. The table of
+these is in HitecDServoSettings.cpp; readSettings() and writeSettings() just
+loop over it. `offset` and `size` locate the field (or fields, for
+failSafe/failSafeLimp) within HitecDSettings, so two HitecDSettings can be
+compared field by field. */
+struct HitecDSettingsCodec {
+  uint16_t field; /* HITECD_FIELD_* */
+  uint8_t reg; /* The register that the field is decoded from */
+  uint8_t rule; /* HD_CODEC_RULE_* */
+  uint8_t offset, size;
+  uint8_t flags; /* HD_CODEC_* */
+};
+
+#define HD_CODEC_RULE_ID 0
+#define HD_CODEC_RULE_DIRECTION 1
+#define HD_CODEC_RULE_SPEED 2
+#define HD_CODEC_RULE_DEADBAND 3
+#define HD_CODEC_RULE_SOFT_START 4
+#define HD_CODEC_RULE_APV 5
+#define HD_CODEC_RULE_FAIL_SAFE 6
+#define HD_CODEC_RULE_POWER_LIMIT 7
+#define HD_CODEC_RULE_OVERLOAD_PROTECTION 8
+#define HD_CODEC_RULE_SMART_SENSE 9
+#define HD_CODEC_RULE_SENSITIVITY_RATIO 10
+
+/* Write MYSTERY_DB before changing the field */
+#define HD_CODEC_MYSTERY_DB 0x01
+/* Write MYSTERY_OP1/2 after changing the field */
+#define HD_CODEC_MYSTERY_OP 0x02
+/* Encoding/decoding needs the SS_{ENABLE,DISABLE}_{1,2} constants */
+#define HD_CODEC_SS_CONSTS 0x04
+
+#define HD_NUM_SETTINGS_CODECS 13
+/* Total number of registers read by decoding all the fields */
+#define HD_SETTINGS_NUM_READ_REGS 14
+/* Most registers written by encoding a single field */
+#define HD_CODEC_MAX_WRITE_REGS 3
+
+/* Copies the i'th entry of the table out of PROGMEM. */
+void hitecdGetSettingsCodec(uint8_t i, HitecDSettingsCodec *codecOut);
+
+/* Stores the registers that the field is decoded from in regsOut[], and returns
+how many there are. */
+uint8_t hitecdCodecReadRegs(const HitecDSettingsCodec &codec, uint8_t *regsOut);
+
+/* Decodes the field from the values of the registers listed by
+hitecdCodecReadRegs(). `ssConsts` holds SS_ENABLE_1, SS_ENABLE_2,
+SS_DISABLE_1, and SS_DISABLE_2, and is only used if the codec has
+HD_CODEC_SS_CONSTS. Returns HITECD_OK, or HITECD_ERR_CONFUSED if the values
+don't make sense. */
+int hitecdDecodeSetting(
+  const HitecDSettingsCodec &codec,
+  const uint16_t *vals,
+  const uint16_t *ssConsts,
+  HitecDSettings *settingsOut);
+
+/* Encodes the field as register writes, and returns how many there are (at
+most HD_CODEC_MAX_WRITE_REGS). Returns 0 for a range of -1, meaning the
+factory default isn't known. */
+uint8_t hitecdEncodeSetting(
+  const HitecDSettingsCodec &codec,
+  const HitecDSettings &settings,
+  const uint16_t *ssConsts,
+  uint8_t *regsOut,
+  uint16_t *valsOut);
+
+/* Copies the fields selected by `fieldMask` from `src` to `*dst`. */
+void hitecdCopySettings(
+  const HitecDSettings &src,
+  HitecDSettings *dst,
+  uint16_t fieldMask);
+
+/* Returns whether the field differs between `a` and `b`. */
+bool hitecdSettingDiffers(
+  const HitecDSettingsCodec &codec,
+  const HitecDSettings &a,
+  const HitecDSettings &b);
+
+/* Most register writes that hitecdDiffSettings() can produce */
+#define HD_SETTINGS_MAX_WRITES 20
+
+/* Lists the register writes that change a servo from `reference` to
+`settings`, including the MYSTERY_DB and MYSTERY_OP1/2 writes that go with
+them, in the order the DPC-11 does them. Returns how many there are. `ssConsts`
+is as for hitecdDecodeSetting(), and is only used if `settings.smartSense`
+differs from `reference.smartSense`. */
+uint8_t hitecdDiffSettings(
+  const HitecDSettings &settings,
+  const HitecDSettings &reference,
+  const uint16_t *ssConsts,
+  uint8_t *regsOut,
+  uint16_t *valsOut);
+
 /*
 Mysterious registers
 ====================
@@ -262,11 +510,7 @@ about how the registers appear to behave.
   returned 36 on the D485HW I tested, and 39 on the D645MW. I don't know what
   this means; maybe a firmware version?
 
-- Register 0x06: The DPC-11 reads register 0x06 at the same time as MODEL_NUMBER
-  and register 0x04. It seems to always return a constant value for each servo,
-  but that constant differs between different servos of the same model, even
-  when reset to factory settings. The values were typically around 19000 for the
-  D485HWs I tested, and 58 for the D645MW.
+- Register 0x06: See FINGERPRINT above.
 
 - Register 0xC4: The DPC-11 also reads register 0xC4 during the startup process,
   but at a different time from MODEL_NUMBER. Always returns 1300. I have no idea
@@ -277,39 +521,14 @@ about how the registers appear to behave.
   minimum and maximum of the APV range, which seems related? But nothing ever
   sets these registers to any other values.
 
-- Register 0x22:
-  - Appears to store the _effective_ power limit. In normal operation, this is
-    the same as the POWER_LIMIT register, but capped at 2000. If overload
-    protection kicks in, this is reduced by the overload protection amount. (For
-    example, if POWER_LIMIT=1600 and OVERLOAD_PROTECTION=50, and then overload
-    protection kicks in, then register 0x22 will read 800.)
-  - Strangely, the DPC-11 sets 0x22 to 0x1000 after any time it changes the
-    DIRECTION or RANGE_*_APV registers; after changing the ID register; and when
-    it first connects to the servo. I have no idea why the DPC-11 does this,
-    because it has no apparent effect. Reading back the 0x22 register always
-    returns the effective power limit, not 0x1000.
-
-- Register 0x10: Appears to store the actual motor power. Measured in the same
-  units as POWER_LIMIT and register 0x22. Reads 0 if the motor is off, otherwise
-  proportional to how much power the motor is exerting. Signed integer. If the
-  motor is stalled, then abs(register_0x10)=register_0x22.
-
-- Register 0xE4: When the TARGET register is written, register 0xE4 appears to
-  be automatically set to the target point as measured in APV units.
-
-- Register 0xEA: I think this might store the difference between CURRENT_APV and
-  register 0xE4?
-
-- Register 0xEC: Appears to always read 0x0000 when the servo is travling to
-  higher APVs, and 0xFFFF when the servo is traveling to lower APVs.
+- Registers 0x22, 0x10, 0xE4, 0xEA, and 0xEC: See EFFECTIVE_POWER_LIMIT,
+  MOTOR_POWER, TARGET_APV, TRACKING_ERROR, and TRAVEL_DIRECTION above.
 
 - Registers 0xDC and 0xE0: Appear to store approximately the same value as
   CURRENT_APV. Perhaps these are past measurements used for calculating
   time-derivatives?
 
-- Registers 0x0E and 0xDE: Signed integers. Typically 0, 1, or -1 when the servo
-  is stationary; larger values when moving. Perhaps time-derivatives of
-  CURRENT_APV?
+- Registers 0x0E and 0xDE: See VELOCITY and VELOCITY_2 above.
 
 - Register 0xFC: Cycles from 0->1->2->3->4->0->[repeat] with a total period of
   about 1 second.
@@ -0,0 +1,36 @@
+#include "HitecDServoInternal.h"
+
+/* Everything the library knows about each servo model. To add a model, add a
+row here (and a HD_MODEL_NUMBER_* constant in HitecDServoInternal.h). Use -1
+for ranges that haven't been measured yet. */
+static const HitecDModelProfile modelProfiles[] PROGMEM = {
+  {
+    HD_MODEL_NUMBER_D485HW,
+    HD_MODEL_SUPPORTED,
+    /* defaultRange{Left,Right,Center}APV */
+    3381, 13002, 8192,
+    /* widestRangeLeftAPV: I measured 731, and added +50 as a margin of
+    error */
+    731 + 50,
+    /* ss{Enable,Disable}{1,2} */
+    14000, 2000, 28000, 4000
+  },
+  {
+    HD_MODEL_NUMBER_D645MW,
+    0,
+    -1, -1, -1,
+    -1,
+    0, 0, 1800, 1400
+  }
+};
+
+bool hitecdFindModelProfile(int modelNumber, HitecDModelProfile *profileOut) {
+  for (uint8_t i = 0; i < sizeof(modelProfiles) / sizeof(modelProfiles[0]);
+      ++i) {
+    if ((int)pgm_read_word(&modelProfiles[i].modelNumber) == modelNumber) {
+      memcpy_P(profileOut, &modelProfiles[i], sizeof(HitecDModelProfile));
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,92 @@
+#ifndef HitecDServoPin_h
+#define HitecDServoPin_h
+
+#include "HitecDServo.h"
+#include "HitecDServoInternal.h"
+#include "HitecDServoBitEngine.h"
+
+/* HitecDServoPin<PIN> is a variant of HitecDServo for when the servo is always
+wired to the same pin. For example:
+    HitecDServoPin<2> servo;
+    ...
+    servo.attach();
+
+It has exactly the same API as HitecDServo (and can be passed anywhere a
+HitecDServo is expected), but the pin's port and bit are known at compile time.
+This lets the bit engine use the single-cycle `in`/`out` instructions instead
+of loads and stores through a pointer, so the polling loop that waits for the
+servo's response is a cycle shorter. (It doesn't make the code smaller: the
+pointer-based engine is still linked in, because the byte functions are
+virtual.)
+
+Right now this supports ATmega328P-based boards (Uno, Nano, Pro Mini) and
+ATmega32U4-based boards (Leonardo, Micro, Pro Micro). On other boards, use
+HitecDServo instead. */
+
+/* The port letter and bit of each Arduino pin, in the same order as the
+standard Arduino pin numbering. These are strings so that they can be indexed
+in a constant expression. */
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || \
+    defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__)
+#define HD_PIN_PORTS "DDDDDDDDBBBBBBCCCCCC"
+#define HD_PIN_BITS  "01234567012345012345"
+#elif defined(__AVR_ATmega32U4__)
+#define HD_PIN_PORTS "DDDDDCDEBBBBDCBBBBFFFFFFDDBBBDD"
+#define HD_PIN_BITS  "2310467645676731207654104745665"
+#endif
+
+#ifdef HD_PIN_PORTS
+
+/* I/O address of the PINx register for the given pin. On both chips, PINB is
+at 0x03, and the PINx, DDRx, PORTx registers of each subsequent port follow in
+groups of three. */
+constexpr uint8_t hitecdPinInputAddress(uint8_t pin) {
+  return (HD_PIN_PORTS[pin] - 'B') * 3 + 0x03;
+}
+
+constexpr uint8_t hitecdPinBitMask(uint8_t pin) {
+  return 1 << (HD_PIN_BITS[pin] - '0');
+}
+
+template<uint8_t PIN>
+class HitecDServoPin : public HitecDServo {
+public:
+  /* Attach to the servo on pin PIN. See HitecDServo::attach(). */
+  int attach() {
+    return HitecDServo::attach(PIN);
+  }
+  using HitecDServo::attach;
+
+protected:
+  static_assert(PIN < sizeof(HD_PIN_PORTS) - 1,
+    "HitecDServoPin doesn't know about this pin");
+
+  static const uint8_t inputAddress = hitecdPinInputAddress(PIN);
+  static const uint8_t outputAddress = inputAddress + 2;
+  static const uint8_t bitMask = hitecdPinBitMask(PIN);
+
+  void writeByte(uint8_t val);
+  int readByte(uint32_t *timeoutLoops);
+  uint8_t readByteLoopCycles();
+};
+
+template<uint8_t PIN>
+void HitecDServoPin<PIN>::writeByte(uint8_t val) {
+  uint8_t high = _SFR_IO8(outputAddress) | bitMask;
+  uint8_t low = _SFR_IO8(outputAddress) & ~bitMask;
+  hitecdWriteByteExactIO<outputAddress>(high, low, val);
+}
+
+template<uint8_t PIN>
+int HitecDServoPin<PIN>::readByte(uint32_t *timeoutLoops) {
+  return hitecdReadByteExactIO<inputAddress>(bitMask, timeoutLoops);
+}
+
+template<uint8_t PIN>
+uint8_t HitecDServoPin<PIN>::readByteLoopCycles() {
+  return HD_WAIT_LOOP_CYCLES_IO;
+}
+
+#endif /* HD_PIN_PORTS */
+
+#endif /* HitecDServoPin_h */
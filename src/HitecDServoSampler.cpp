@@ -0,0 +1,249 @@
+#include "HitecDServoSampler.h"
+
+#include "HitecDServoInternal.h"
+
+static_assert(HITECD_SAMPLER_DEFAULT_PERIOD_US >=
+    HD_READ_CYCLE_US + 2 * HD_READ_POLL_INTERVAL_US,
+  "HITECD_SAMPLER_DEFAULT_PERIOD_US is shorter than a read");
+
+/* Encoding of samples in the buffer. Times are stored relative to the previous
+sample's time as read() decodes it, so errors don't add up. Each sample starts
+with a byte that says how it's encoded:
+- 0b0ddddddd: the position changed by d (a 7-bit signed number), and the sample
+  was taken one period after the previous one, give or take
+  HD_SAMPLE_ON_TIME_US.
+- 0b10dddddd, followed by a signed byte t: the position changed by d (a 6-bit
+  signed number), and the sample was taken one period plus t units of
+  HD_SAMPLE_TIME_UNIT_US after the previous one.
+- HD_SAMPLE_MEDIUM, followed by a 16-bit position difference and a 16-bit
+  unsigned time difference in units (little-endian).
+- HD_SAMPLE_KEYFRAME, followed by the 32-bit time and 16-bit position
+  (little-endian). The first sample, any sample after a sample was dropped, and
+  any sample after a gap too long for HD_SAMPLE_MEDIUM is stored like this. */
+#define HD_SAMPLE_ON_TIME_US 64
+#define HD_SAMPLE_TIME_UNIT_US 16
+#define HD_SAMPLE_SHORT_MAX_DELTA 63
+#define HD_SAMPLE_OFFSET 0x80
+#define HD_SAMPLE_OFFSET_MAX_DELTA 31
+#define HD_SAMPLE_OFFSET_MAX_UNITS 127
+#define HD_SAMPLE_MEDIUM 0xC0
+#define HD_SAMPLE_MEDIUM_MAX_UNITS 0xFFFF
+#define HD_SAMPLE_KEYFRAME 0xC1
+#define HD_SAMPLE_MAX_LEN 7
+
+/* Rounds `us` to the nearest number of time units */
+static long toTimeUnits(long us) {
+  long half = HD_SAMPLE_TIME_UNIT_US / 2;
+  return (us + (us < 0 ? -half : half)) / HD_SAMPLE_TIME_UNIT_US;
+}
+
+HitecDServoSampler::HitecDServoSampler() :
+  servo(NULL),
+  running(false),
+  reading(false),
+  buffer(NULL),
+  bufferLen(0),
+  head(0),
+  tail(0),
+  dropped(0)
+{ }
+
+int HitecDServoSampler::begin(
+  HitecDServo *_servo,
+  uint8_t *_buffer,
+  uint16_t _bufferLen,
+  unsigned long _periodMicros
+) {
+  end();
+  if (!_servo->attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  servo = _servo;
+  buffer = _buffer;
+  bufferLen = _bufferLen;
+  head = tail = 0;
+  dropped = 0;
+  periodMicros = _periodMicros;
+  nextTickMicros = micros();
+  needKeyframe = true;
+  running = true;
+  return HITECD_OK;
+}
+
+void HitecDServoSampler::end() {
+  if (!running) {
+    return;
+  }
+  while (reading) {
+    poll();
+  }
+  running = false;
+}
+
+int HitecDServoSampler::poll() {
+  if (!running) {
+    return HITECD_PENDING;
+  }
+
+  if (reading) {
+    uint16_t val;
+    int res = servo->pollReadRawRegister(&val);
+    if (res == HITECD_PENDING) {
+      return HITECD_PENDING;
+    }
+    reading = false;
+    servo->readCooldownMicros = HD_READ_COOLDOWN_US;
+    if (res == HITECD_OK) {
+      store(servo->readStartMicros, (int16_t)val);
+    }
+    /* Don't wait for another call to start the next read */
+    startReadIfDue();
+    return res;
+  }
+
+  return startReadIfDue();
+}
+
+int HitecDServoSampler::startReadIfDue() {
+  unsigned long now = micros();
+  if ((long)(now - nextTickMicros) < 0) {
+    return HITECD_PENDING;
+  }
+
+  /* If we're more than a period late, skip the samples we missed. */
+  nextTickMicros += (now - nextTickMicros) / periodMicros * periodMicros;
+
+  /* The next request follows soon after this read, so there's no need for the
+  full cooldown. */
+  servo->readCooldownMicros = HD_READ_BATCH_GAP_US;
+  int res = servo->beginReadRawRegister(HD_REG_CURRENT_APV);
+  nextTickMicros += periodMicros;
+  if (res != HITECD_OK) {
+    servo->readCooldownMicros = HD_READ_COOLDOWN_US;
+    return res;
+  }
+  reading = true;
+  return HITECD_PENDING;
+}
+
+void HitecDServoSampler::store(unsigned long sampleMicros, int16_t apv) {
+  uint8_t bytes[HD_SAMPLE_MAX_LEN];
+  uint8_t len;
+  unsigned long elapsed = sampleMicros - lastMicros;
+  long late = (long)(elapsed - periodMicros);
+  long offset = toTimeUnits(late);
+  unsigned long units = (elapsed + HD_SAMPLE_TIME_UNIT_US / 2) /
+    HD_SAMPLE_TIME_UNIT_US;
+  int16_t delta = apv - lastAPV;
+  unsigned long decodedMicros;
+
+  if (needKeyframe || units > HD_SAMPLE_MEDIUM_MAX_UNITS) {
+    bytes[0] = HD_SAMPLE_KEYFRAME;
+    bytes[1] = sampleMicros & 0xFF;
+    bytes[2] = (sampleMicros >> 8) & 0xFF;
+    bytes[3] = (sampleMicros >> 16) & 0xFF;
+    bytes[4] = (sampleMicros >> 24) & 0xFF;
+    bytes[5] = apv & 0xFF;
+    bytes[6] = (apv >> 8) & 0xFF;
+    len = 7;
+    decodedMicros = sampleMicros;
+  } else if (late >= -HD_SAMPLE_ON_TIME_US && late <= HD_SAMPLE_ON_TIME_US &&
+      delta >= -HD_SAMPLE_SHORT_MAX_DELTA - 1 &&
+      delta <= HD_SAMPLE_SHORT_MAX_DELTA) {
+    bytes[0] = delta & 0x7F;
+    len = 1;
+    decodedMicros = lastMicros + periodMicros;
+  } else if (offset >= -HD_SAMPLE_OFFSET_MAX_UNITS - 1 &&
+      offset <= HD_SAMPLE_OFFSET_MAX_UNITS &&
+      delta >= -HD_SAMPLE_OFFSET_MAX_DELTA - 1 &&
+      delta <= HD_SAMPLE_OFFSET_MAX_DELTA) {
+    bytes[0] = HD_SAMPLE_OFFSET | (delta & 0x3F);
+    bytes[1] = offset & 0xFF;
+    len = 2;
+    decodedMicros = lastMicros + periodMicros + offset * HD_SAMPLE_TIME_UNIT_US;
+  } else {
+    bytes[0] = HD_SAMPLE_MEDIUM;
+    bytes[1] = delta & 0xFF;
+    bytes[2] = (delta >> 8) & 0xFF;
+    bytes[3] = units & 0xFF;
+    bytes[4] = (units >> 8) & 0xFF;
+    len = 5;
+    decodedMicros = lastMicros + units * HD_SAMPLE_TIME_UNIT_US;
+  }
+
+  /* One byte of the buffer is left unused, so that head == tail only when it's
+  empty. */
+  uint16_t used = head >= tail ? head - tail : head + bufferLen - tail;
+  if (used + len >= bufferLen) {
+    if (dropped != 0xFFFF) {
+      ++dropped;
+    }
+    needKeyframe = true;
+    return;
+  }
+
+  for (uint8_t i = 0; i < len; ++i) {
+    buffer[head] = bytes[i];
+    head = head + 1 == bufferLen ? 0 : head + 1;
+  }
+  needKeyframe = false;
+  lastMicros = decodedMicros;
+  lastAPV = apv;
+}
+
+uint8_t HitecDServoSampler::takeByte() {
+  uint8_t byte = buffer[tail];
+  tail = tail + 1 == bufferLen ? 0 : tail + 1;
+  return byte;
+}
+
+int HitecDServoSampler::read(HitecDSample *sampleOut) {
+  if (tail == head) {
+    return HITECD_PENDING;
+  }
+
+  uint8_t first = takeByte();
+  if (first == HD_SAMPLE_KEYFRAME) {
+    outMicros = takeByte();
+    outMicros |= (unsigned long)takeByte() << 8;
+    outMicros |= (unsigned long)takeByte() << 16;
+    outMicros |= (unsigned long)takeByte() << 24;
+    outAPV = takeByte();
+    outAPV |= (uint16_t)takeByte() << 8;
+  } else if (first == HD_SAMPLE_MEDIUM) {
+    uint16_t delta = takeByte();
+    delta |= (uint16_t)takeByte() << 8;
+    outAPV += (int16_t)delta;
+    unsigned long units = takeByte();
+    units |= (unsigned long)takeByte() << 8;
+    outMicros += units * HD_SAMPLE_TIME_UNIT_US;
+  } else if (first & HD_SAMPLE_OFFSET) {
+    /* Sign-extend the 6-bit difference */
+    outAPV += (int8_t)(first << 2) >> 2;
+    long offset = (int8_t)takeByte();
+    outMicros += periodMicros + offset * HD_SAMPLE_TIME_UNIT_US;
+  } else {
+    /* Sign-extend the 7-bit difference */
+    outAPV += (int8_t)(first << 1) >> 1;
+    outMicros += periodMicros;
+  }
+
+  sampleOut->micros = outMicros;
+  sampleOut->apv = outAPV;
+  return HITECD_OK;
+}
+
+uint16_t HitecDServoSampler::drain(
+  HitecDSample *samplesOut,
+  uint16_t maxSamples
+) {
+  uint16_t n = 0;
+  while (n < maxSamples && read(&samplesOut[n]) == HITECD_OK) {
+    ++n;
+  }
+  return n;
+}
+
+uint16_t HitecDServoSampler::droppedSamples() {
+  return dropped;
+}
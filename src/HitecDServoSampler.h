@@ -0,0 +1,114 @@
+#ifndef HitecDServoSampler_h
+#define HitecDServoSampler_h
+
+#include "HitecDServo.h"
+
+/* The default time between samples. Back-to-back reads start about 16.65ms
+apart at best, and two of the waits within each read end in a poll() call,
+which may come up to 1ms late, so this is about as fast as the servo can be
+sampled (about 54Hz). A shorter period makes the sampler fall behind and skip
+samples. */
+#define HITECD_SAMPLER_DEFAULT_PERIOD_US 18650
+
+/* One position sample, as returned by HitecDServoSampler::read() */
+struct HitecDSample {
+  /* micros() when the read request finished sending, to within 64us */
+  unsigned long micros;
+  /* The servo's position, in APV units (see readCurrentAPV()) */
+  int16_t apv;
+};
+
+/* HitecDServoSampler records the position of a servo in the background, by
+reading CURRENT_APV over and over at a fixed rate, without blocking. The samples
+are stored in a buffer that you provide, and taken back out with read() or
+drain(), in the order they were taken.
+
+Consecutive samples are usually close together in both time and position, so
+they're stored as differences from the previous sample: a sample taken on time
+(within 64us of a period after the previous one) that moved less than 64 APV
+units takes 1 byte, so a 2KB buffer holds about 2000 samples (about 37 seconds
+at the default period). A sample that's late, e.g. because poll() wasn't called
+promptly, takes 2 bytes if it's within 2ms and moved less than 32 APV units.
+Other samples take 5 bytes, or 7 bytes if they follow a gap of more than a
+second.
+
+If the buffer fills up, new samples are dropped (and counted; see
+droppedSamples()) until there's room again.
+
+Example usage:
+    HitecDServo servo;
+    HitecDServoSampler sampler;
+    uint8_t buffer[2048];
+    ...
+    sampler.begin(&servo, buffer, sizeof(buffer));
+    while (true) {
+      sampler.poll();
+      HitecDSample sample;
+      while (sampler.read(&sample) == HITECD_OK) {
+        (do something with sample.micros and sample.apv)
+      }
+      (do something else for less than 1ms)
+    }
+
+While the sampler is running, don't call any other methods on the servo. */
+class HitecDServoSampler {
+public:
+  HitecDServoSampler();
+
+  /* Starts sampling the given servo, storing samples in the given buffer, with
+  `periodMicros` between samples. Returns HITECD_OK, or
+  HITECD_ERR_NOT_ATTACHED if the servo isn't attached. */
+  int begin(HitecDServo *servo, uint8_t *buffer, uint16_t bufferLen,
+    unsigned long periodMicros = HITECD_SAMPLER_DEFAULT_PERIOD_US);
+
+  /* Stops sampling, waiting for the current read (if any) to finish. Samples
+  already in the buffer can still be read. */
+  void end();
+
+  /* Starts a read when the next sample is due, and advances the read that's in
+  progress. Like HitecDServo::pollReadRawRegister(), this must be called at
+  least once per millisecond while sampling. If the sampler falls more than a
+  period behind, it skips the samples it missed. Returns HITECD_OK if it stored
+  a sample, HITECD_PENDING if there was nothing to do, or an error code if a
+  read failed; that sample is just skipped. */
+  int poll();
+
+  /* Takes the oldest sample out of the buffer. Returns HITECD_OK, or
+  HITECD_PENDING if the buffer is empty. */
+  int read(HitecDSample *sampleOut);
+
+  /* Takes up to `maxSamples` samples out of the buffer, oldest first, and
+  returns how many it took. */
+  uint16_t drain(HitecDSample *samplesOut, uint16_t maxSamples);
+
+  /* Number of samples that didn't fit in the buffer since begin() */
+  uint16_t droppedSamples();
+
+private:
+  int startReadIfDue();
+  void store(unsigned long sampleMicros, int16_t apv);
+  uint8_t takeByte();
+
+  HitecDServo *servo;
+  bool running, reading;
+
+  uint8_t *buffer;
+  uint16_t bufferLen, head, tail;
+  uint16_t dropped;
+
+  unsigned long periodMicros;
+  /* When the next read is due */
+  unsigned long nextTickMicros;
+
+  /* The last sample stored, for computing differences, with its time as read()
+  will decode it. If `needKeyframe`, the next sample is stored in full. */
+  bool needKeyframe;
+  unsigned long lastMicros;
+  int16_t lastAPV;
+
+  /* The last sample taken out by read() */
+  unsigned long outMicros;
+  int16_t outAPV;
+};
+
+#endif /* HitecDServoSampler_h */
@@ -0,0 +1,150 @@
+#include "HitecDServoScheduler.h"
+
+#include "HitecDServoInternal.h"
+
+/* Per-servo states */
+#define HD_SCHED_IDLE 0
+#define HD_SCHED_QUEUED 1
+#define HD_SCHED_IN_FLIGHT 2
+
+HitecDServoScheduler::HitecDServoScheduler() :
+  count(0),
+  nextToStart(0)
+{ }
+
+int HitecDServoScheduler::add(HitecDServo *servo) {
+  if (!servo->attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (count == HITECD_SCHEDULER_MAX) {
+    return HITECD_ERR_GROUP_FULL;
+  }
+  servos[count] = servo;
+  states[count] = HD_SCHED_IDLE;
+  results[count] = HITECD_ERR_CONFUSED;
+  return count++;
+}
+
+uint8_t HitecDServoScheduler::size() {
+  return count;
+}
+
+int HitecDServoScheduler::beginRead(uint8_t index, uint8_t reg) {
+  if (index >= count) {
+    return HITECD_ERR_CONFUSED;
+  }
+  if (states[index] != HD_SCHED_IDLE) {
+    return HITECD_ERR_BUSY;
+  }
+  regs[index] = reg;
+  results[index] = HITECD_PENDING;
+  states[index] = HD_SCHED_QUEUED;
+  return HITECD_OK;
+}
+
+/* Each read blocks the CPU from HD_READ_RELEASE_US after its request until its
+response has been received; call that its window. A new read must not start if
+sending its request would overlap another read's window, or if its own window
+would overlap another read's window. Since every read has the same shape, that
+works out to a condition on how long ago each other read started. */
+bool HitecDServoScheduler::canStartRead(unsigned long now) {
+  const unsigned long windowUs = HD_READ_RESPONSE_US + HD_READ_RESPONSE_LEN_US +
+    HD_READ_RESPONSE_GUARD_US - HD_READ_RELEASE_US;
+  const unsigned long windowEndUs = HD_READ_RESPONSE_US +
+    HD_READ_RESPONSE_LEN_US + HD_READ_RESPONSE_GUARD_US;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    if (states[i] != HD_SCHED_IN_FLIGHT) {
+      continue;
+    }
+    /* Where the new read's request would end, relative to read i's start */
+    unsigned long sinceStart = now - startMicros[i] + HD_READ_REQUEST_LEN_US;
+    if (sinceStart < windowUs) {
+      /* The windows would overlap */
+      return false;
+    }
+    if (sinceStart > HD_READ_RELEASE_US && sinceStart - HD_READ_REQUEST_LEN_US <
+        windowEndUs) {
+      /* The request would overlap read i's window */
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HitecDServoScheduler::poll() {
+  bool done = true;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    if (states[i] != HD_SCHED_IN_FLIGHT) {
+      continue;
+    }
+    int res = servos[i]->pollReadRawRegister(&values[i]);
+    if (res == HITECD_PENDING) {
+      done = false;
+    } else {
+      results[i] = res;
+      states[i] = HD_SCHED_IDLE;
+    }
+  }
+
+  for (uint8_t j = 0; j < count; ++j) {
+    uint8_t i = (nextToStart + j) % count;
+    if (states[i] != HD_SCHED_QUEUED) {
+      continue;
+    }
+    done = false;
+    if (!canStartRead(micros())) {
+      break;
+    }
+    int res = servos[i]->beginReadRawRegister(regs[i]);
+    if (res != HITECD_OK) {
+      results[i] = res;
+      states[i] = HD_SCHED_IDLE;
+      continue;
+    }
+    startMicros[i] = micros();
+    states[i] = HD_SCHED_IN_FLIGHT;
+    nextToStart = (i + 1) % count;
+  }
+
+  return done;
+}
+
+int HitecDServoScheduler::result(uint8_t index, uint16_t *valOut) {
+  if (index >= count) {
+    return HITECD_ERR_CONFUSED;
+  }
+  if (states[index] != HD_SCHED_IDLE) {
+    return HITECD_PENDING;
+  }
+  if (results[index] == HITECD_OK) {
+    *valOut = values[index];
+  }
+  return results[index];
+}
+
+void HitecDServoScheduler::readRawRegisters(
+  uint8_t reg,
+  uint16_t *valsOut,
+  int *resultsOut
+) {
+  for (uint8_t i = 0; i < count; ++i) {
+    resultsOut[i] = beginRead(i, reg);
+  }
+  while (!poll()) { }
+  for (uint8_t i = 0; i < count; ++i) {
+    if (resultsOut[i] == HITECD_OK) {
+      resultsOut[i] = result(i, &valsOut[i]);
+    }
+  }
+}
+
+void HitecDServoScheduler::readCurrentAPVs(int16_t *apvsOut) {
+  uint16_t vals[HITECD_SCHEDULER_MAX];
+  int results[HITECD_SCHEDULER_MAX];
+  readRawRegisters(HD_REG_CURRENT_APV, vals, results);
+  for (uint8_t i = 0; i < count; ++i) {
+    apvsOut[i] = (results[i] == HITECD_OK) ? (int16_t)vals[i] : results[i];
+  }
+}
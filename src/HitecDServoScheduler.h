@@ -0,0 +1,102 @@
+#ifndef HitecDServoScheduler_h
+#define HitecDServoScheduler_h
+
+#include "HitecDServo.h"
+
+/* The maximum number of servos in a HitecDServoScheduler */
+#define HITECD_SCHEDULER_MAX 8
+
+/* HitecDServoScheduler reads registers from several servos, overlapping the
+reads so that the ~15ms each servo spends preparing its response is used to send
+requests to the other servos. Unlike HitecDServoGroup, the servos can be on any
+pins.
+
+Only one servo's response can be received at a time, and sending a request
+blocks interrupts for about 450us, so the scheduler staggers the requests so
+that no two responses (or a request and a response) overlap. Each read occupies
+the line for a window of about 2.3ms around its response, so up to about 7
+reads can be in flight at once, and reading 7 servos takes not much longer than
+reading one.
+
+Example usage:
+    HitecDServo servo1, servo2;
+    HitecDServoScheduler scheduler;
+    ...
+    scheduler.add(&servo1);
+    scheduler.add(&servo2);
+    ...
+    int16_t apvs[2];
+    scheduler.readCurrentAPVs(apvs);
+
+Or, without blocking (0x0C is the register that holds the current position, in
+APV units):
+    scheduler.beginRead(0, 0x0C);
+    scheduler.beginRead(1, 0x0C);
+    ...
+    while (!scheduler.poll()) {
+      (do something else for less than 1ms)
+    }
+    scheduler.result(0, &val0);
+    scheduler.result(1, &val1);
+
+While the scheduler is using a servo, don't call any other methods on it. */
+class HitecDServoScheduler {
+public:
+  HitecDServoScheduler();
+
+  /* Adds an attached servo. Returns the servo's index within the scheduler (0
+  for the first servo added, and so on), or an error code:
+  - HITECD_ERR_NOT_ATTACHED if the servo isn't attached.
+  - HITECD_ERR_GROUP_FULL if the scheduler already has HITECD_SCHEDULER_MAX
+    servos. */
+  int add(HitecDServo *servo);
+
+  /* Number of servos in the scheduler */
+  uint8_t size();
+
+  /* Queues a read of register `reg` (a raw register number, as for
+  HitecDServo::readRawRegister()) from the servo with the given index. The read
+  is actually started by poll(). Returns HITECD_OK, HITECD_ERR_BUSY if a read
+  from that servo is already queued or in progress, or HITECD_ERR_CONFUSED if
+  there's no servo with that index. */
+  int beginRead(uint8_t index, uint8_t reg);
+
+  /* Starts queued reads when there's room for them, and advances the reads that
+  are in progress. Returns true once no reads are queued or in progress. Like
+  HitecDServo::pollReadRawRegister(), this must be called at least once per
+  millisecond while reads are in progress, and it occasionally blocks for up to
+  about 2ms while a response is being received. */
+  bool poll();
+
+  /* Returns the result of the last read from the servo with the given index:
+  HITECD_PENDING if it's still queued or in progress, HITECD_OK (with the value
+  stored in *valOut), or an error code (HITECD_ERR_CONFUSED if there's no
+  servo with that index). */
+  int result(uint8_t index, uint16_t *valOut);
+
+  /* Blocking convenience methods: read the same register from every servo, and
+  wait for all the reads to finish. `resultsOut[i]` gets the result for the
+  servo with index i. readCurrentAPVs() works like
+  HitecDServoGroup::readCurrentAPVs(). */
+  void readRawRegisters(uint8_t reg, uint16_t *valsOut, int *resultsOut);
+  void readCurrentAPVs(int16_t *apvsOut);
+
+private:
+  bool canStartRead(unsigned long now);
+
+  HitecDServo *servos[HITECD_SCHEDULER_MAX];
+  uint8_t count;
+
+  /* Per-servo state */
+  uint8_t states[HITECD_SCHEDULER_MAX];
+  uint8_t regs[HITECD_SCHEDULER_MAX];
+  unsigned long startMicros[HITECD_SCHEDULER_MAX];
+  int results[HITECD_SCHEDULER_MAX];
+  uint16_t values[HITECD_SCHEDULER_MAX];
+
+  /* Index of the servo to consider starting first, so that every servo gets a
+  turn even if poll() can only start one read at a time. */
+  uint8_t nextToStart;
+};
+
+#endif /* HitecDServoScheduler_h */
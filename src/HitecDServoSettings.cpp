@@ -0,0 +1,346 @@
+#include "HitecDServo.h"
+
+#include <stddef.h>
+
+#include "HitecDServoInternal.h"
+
+#define HD_CODEC(fieldFlag, reg, rule, member, size, flags) \
+  { fieldFlag, reg, rule, offsetof(HitecDSettings, member), size, flags }
+
+/* One entry per setting, in the order that readSettings() reads them and
+writeSettings() writes them. The order matches what the DPC-11 does. */
+static const HitecDSettingsCodec settingsCodecs[HD_NUM_SETTINGS_CODECS]
+    PROGMEM = {
+  HD_CODEC(HITECD_FIELD_ID, HD_REG_ID,
+    HD_CODEC_RULE_ID, id, 1, 0),
+  HD_CODEC(HITECD_FIELD_COUNTERCLOCKWISE, HD_REG_DIRECTION,
+    HD_CODEC_RULE_DIRECTION, counterclockwise, 1, 0),
+  HD_CODEC(HITECD_FIELD_SPEED, HD_REG_SPEED,
+    HD_CODEC_RULE_SPEED, speed, 1, 0),
+  HD_CODEC(HITECD_FIELD_DEADBAND, HD_REG_DEADBAND_1,
+    HD_CODEC_RULE_DEADBAND, deadband, 1, HD_CODEC_MYSTERY_DB),
+  HD_CODEC(HITECD_FIELD_SOFT_START, HD_REG_SOFT_START,
+    HD_CODEC_RULE_SOFT_START, softStart, 1, 0),
+  HD_CODEC(HITECD_FIELD_RANGE, HD_REG_RANGE_LEFT_APV,
+    HD_CODEC_RULE_APV, rangeLeftAPV, 2, 0),
+  HD_CODEC(HITECD_FIELD_RANGE, HD_REG_RANGE_RIGHT_APV,
+    HD_CODEC_RULE_APV, rangeRightAPV, 2, 0),
+  HD_CODEC(HITECD_FIELD_RANGE, HD_REG_RANGE_CENTER_APV,
+    HD_CODEC_RULE_APV, rangeCenterAPV, 2, 0),
+  /* failSafe and failSafeLimp are adjacent, and share a register */
+  HD_CODEC(HITECD_FIELD_FAIL_SAFE, HD_REG_FAIL_SAFE,
+    HD_CODEC_RULE_FAIL_SAFE, failSafe, 3, 0),
+  HD_CODEC(HITECD_FIELD_POWER_LIMIT, HD_REG_POWER_LIMIT,
+    HD_CODEC_RULE_POWER_LIMIT, powerLimit, 2, 0),
+  HD_CODEC(HITECD_FIELD_OVERLOAD_PROTECTION, HD_REG_OVERLOAD_PROTECTION,
+    HD_CODEC_RULE_OVERLOAD_PROTECTION, overloadProtection, 1,
+    HD_CODEC_MYSTERY_OP),
+  HD_CODEC(HITECD_FIELD_SMART_SENSE, HD_REG_SMART_SENSE_1,
+    HD_CODEC_RULE_SMART_SENSE, smartSense, 1,
+    HD_CODEC_MYSTERY_DB | HD_CODEC_SS_CONSTS),
+  HD_CODEC(HITECD_FIELD_SENSITIVITY_RATIO, HD_REG_SENSITIVITY_RATIO,
+    HD_CODEC_RULE_SENSITIVITY_RATIO, sensitivityRatio, 2, 0)
+};
+
+static_assert(
+  offsetof(HitecDSettings, failSafeLimp) ==
+    offsetof(HitecDSettings, failSafe) + 2,
+  "The FAIL_SAFE codec assumes failSafeLimp follows failSafe");
+
+void hitecdGetSettingsCodec(uint8_t i, HitecDSettingsCodec *codecOut) {
+  memcpy_P(codecOut, &settingsCodecs[i], sizeof(HitecDSettingsCodec));
+}
+
+uint8_t hitecdCodecReadRegs(
+  const HitecDSettingsCodec &codec,
+  uint8_t *regsOut
+) {
+  regsOut[0] = codec.reg;
+  if (codec.rule == HD_CODEC_RULE_SMART_SENSE) {
+    regsOut[1] = HD_REG_SMART_SENSE_2;
+    return 2;
+  }
+  return 1;
+}
+
+int hitecdDecodeSetting(
+  const HitecDSettingsCodec &codec,
+  const uint16_t *vals,
+  const uint16_t *ssConsts,
+  HitecDSettings *settingsOut
+) {
+  uint16_t val = vals[0];
+  void *field = (uint8_t *)settingsOut + codec.offset;
+
+  switch (codec.rule) {
+    case HD_CODEC_RULE_ID:
+      if (val > 255) {
+        return HITECD_ERR_CONFUSED;
+      }
+      settingsOut->id = val;
+      return HITECD_OK;
+
+    case HD_CODEC_RULE_DIRECTION:
+      if (val == HD_DIRECTION_CLOCKWISE) {
+        settingsOut->counterclockwise = false;
+      } else if (val == HD_DIRECTION_COUNTERCLOCKWISE) {
+        settingsOut->counterclockwise = true;
+      } else {
+        return HITECD_ERR_CONFUSED;
+      }
+      return HITECD_OK;
+
+    case HD_CODEC_RULE_SPEED:
+      if (val == 0x0FFF) {
+        settingsOut->speed = 100;
+      } else if (val < 20) {
+        settingsOut->speed = val*5;
+      } else {
+        return HITECD_ERR_CONFUSED;
+      }
+      return HITECD_OK;
+
+    /* There are three deadband-related registers, and their values are
+    expected to be consistent with each other. We used to read all three
+    registers and assert the values were consistent; but occasionally the latter
+    two registers would read as 0, causing failures. So now we just read the
+    first register. The DPC-11 software also only reads the first register. */
+    case HD_CODEC_RULE_DEADBAND:
+      if (val == 1) {
+        settingsOut->deadband = 1;
+      } else if (val >= 4 && val <= 36 && val % 4 == 0) {
+        settingsOut->deadband = val / 4 + 1;
+      } else {
+        return HITECD_ERR_CONFUSED;
+      }
+      return HITECD_OK;
+
+    case HD_CODEC_RULE_SOFT_START:
+      switch (val) {
+        case HD_SOFT_START_20: settingsOut->softStart = 20; break;
+        case HD_SOFT_START_40: settingsOut->softStart = 40; break;
+        case HD_SOFT_START_60: settingsOut->softStart = 60; break;
+        case HD_SOFT_START_80: settingsOut->softStart = 80; break;
+        case HD_SOFT_START_100: settingsOut->softStart = 100; break;
+        default: return HITECD_ERR_CONFUSED;
+      }
+      return HITECD_OK;
+
+    case HD_CODEC_RULE_APV:
+      *(int16_t *)field = val;
+      return HITECD_OK;
+
+    /* A single register controls both failSafe and failSafeLimp. */
+    case HD_CODEC_RULE_FAIL_SAFE:
+      if (val >= 850 && val <= 2150) {
+        settingsOut->failSafe = val;
+        settingsOut->failSafeLimp = false;
+      } else if (val == HD_FAIL_SAFE_LIMP) {
+        settingsOut->failSafe = 0;
+        settingsOut->failSafeLimp = true;
+      } else if (val == HD_FAIL_SAFE_OFF) {
+        settingsOut->failSafe = 0;
+        settingsOut->failSafeLimp = false;
+      } else {
+        return HITECD_ERR_CONFUSED;
+      }
+      return HITECD_OK;
+
+    case HD_CODEC_RULE_POWER_LIMIT:
+      if (val == 0x0FFF) {
+        settingsOut->powerLimit = 100;
+      } else {
+        /* Divide rounding up, so nonzero values stay nonzero */
+        settingsOut->powerLimit = (val + 19) / 20;
+      }
+      return HITECD_OK;
+
+    case HD_CODEC_RULE_OVERLOAD_PROTECTION:
+      settingsOut->overloadProtection = val;
+      return HITECD_OK;
+
+    /* smartSense is controlled by two registers, 0x44 and 0x6C. If smartSense
+    is enabled, these should be set to the values of SS_ENABLE_1/2; if it's
+    disabled, to the values of SS_DISABLE_1/2. */
+    case HD_CODEC_RULE_SMART_SENSE:
+      if (vals[0] == ssConsts[0] && vals[1] == ssConsts[1]) {
+        settingsOut->smartSense = true;
+      } else if (vals[0] == ssConsts[2] && vals[1] == ssConsts[3]) {
+        settingsOut->smartSense = false;
+      } else {
+        return HITECD_ERR_CONFUSED;
+      }
+      return HITECD_OK;
+
+    case HD_CODEC_RULE_SENSITIVITY_RATIO:
+      if (val < HD_SENSITIVITY_RATIO_MIN || val > HD_SENSITIVITY_RATIO_MAX) {
+        return HITECD_ERR_CONFUSED;
+      }
+      settingsOut->sensitivityRatio = val;
+      return HITECD_OK;
+
+    default:
+      return HITECD_ERR_CONFUSED;
+  }
+}
+
+uint8_t hitecdEncodeSetting(
+  const HitecDSettingsCodec &codec,
+  const HitecDSettings &settings,
+  const uint16_t *ssConsts,
+  uint8_t *regsOut,
+  uint16_t *valsOut
+) {
+  const void *field = (const uint8_t *)&settings + codec.offset;
+
+  regsOut[0] = codec.reg;
+  switch (codec.rule) {
+    case HD_CODEC_RULE_ID:
+      valsOut[0] = settings.id;
+      return 1;
+
+    case HD_CODEC_RULE_DIRECTION:
+      valsOut[0] = settings.counterclockwise ?
+        HD_DIRECTION_COUNTERCLOCKWISE : HD_DIRECTION_CLOCKWISE;
+      return 1;
+
+    case HD_CODEC_RULE_SPEED:
+      valsOut[0] = settings.speed == 100 ? 0x0FFF : settings.speed / 5;
+      return 1;
+
+    /* The factory default deadband=1 doesn't follow the same formula as the
+    other values. */
+    case HD_CODEC_RULE_DEADBAND:
+      regsOut[1] = HD_REG_DEADBAND_2;
+      regsOut[2] = HD_REG_DEADBAND_3;
+      if (settings.deadband == 1) {
+        valsOut[0] = 1;
+        valsOut[1] = 5;
+        valsOut[2] = 11;
+      } else {
+        valsOut[0] = 4 * settings.deadband - 4;
+        valsOut[1] = 4 * settings.deadband;
+        valsOut[2] = 4 * settings.deadband + 6;
+      }
+      return 3;
+
+    case HD_CODEC_RULE_SOFT_START:
+      switch (settings.softStart) {
+        case 40: valsOut[0] = HD_SOFT_START_40; break;
+        case 60: valsOut[0] = HD_SOFT_START_60; break;
+        case 80: valsOut[0] = HD_SOFT_START_80; break;
+        case 100: valsOut[0] = HD_SOFT_START_100; break;
+        default: valsOut[0] = HD_SOFT_START_20; break;
+      }
+      return 1;
+
+    case HD_CODEC_RULE_APV:
+      if (*(const int16_t *)field == -1) {
+        return 0;
+      }
+      valsOut[0] = *(const int16_t *)field;
+      return 1;
+
+    case HD_CODEC_RULE_FAIL_SAFE:
+      if (settings.failSafe != 0) {
+        valsOut[0] = settings.failSafe;
+      } else if (settings.failSafeLimp) {
+        valsOut[0] = HD_FAIL_SAFE_LIMP;
+      } else {
+        valsOut[0] = HD_FAIL_SAFE_OFF;
+      }
+      return 1;
+
+    case HD_CODEC_RULE_POWER_LIMIT:
+      valsOut[0] = settings.powerLimit == 100 ?
+        0x0FFF : settings.powerLimit * 20;
+      return 1;
+
+    case HD_CODEC_RULE_OVERLOAD_PROTECTION:
+      valsOut[0] = settings.overloadProtection;
+      return 1;
+
+    case HD_CODEC_RULE_SMART_SENSE: {
+      uint8_t i = settings.smartSense ? 0 : 2;
+      regsOut[1] = HD_REG_SMART_SENSE_2;
+      valsOut[0] = ssConsts[i];
+      valsOut[1] = ssConsts[i + 1];
+      return 2;
+    }
+
+    case HD_CODEC_RULE_SENSITIVITY_RATIO:
+      valsOut[0] = settings.sensitivityRatio;
+      return 1;
+
+    default:
+      return 0;
+  }
+}
+
+void hitecdCopySettings(
+  const HitecDSettings &src,
+  HitecDSettings *dst,
+  uint16_t fieldMask
+) {
+  HitecDSettingsCodec codec;
+  for (uint8_t i = 0; i < HD_NUM_SETTINGS_CODECS; ++i) {
+    hitecdGetSettingsCodec(i, &codec);
+    if (fieldMask & codec.field) {
+      memcpy((uint8_t *)dst + codec.offset,
+        (const uint8_t *)&src + codec.offset, codec.size);
+    }
+  }
+}
+
+bool hitecdSettingDiffers(
+  const HitecDSettingsCodec &codec,
+  const HitecDSettings &a,
+  const HitecDSettings &b
+) {
+  return memcmp((const uint8_t *)&a + codec.offset,
+    (const uint8_t *)&b + codec.offset, codec.size) != 0;
+}
+
+uint8_t hitecdDiffSettings(
+  const HitecDSettings &settings,
+  const HitecDSettings &reference,
+  const uint16_t *ssConsts,
+  uint8_t *regsOut,
+  uint16_t *valsOut
+) {
+  uint8_t n = 0;
+  bool wroteMysteryDB = false;
+  HitecDSettingsCodec codec;
+
+  for (uint8_t i = 0; i < HD_NUM_SETTINGS_CODECS; ++i) {
+    hitecdGetSettingsCodec(i, &codec);
+    if (!hitecdSettingDiffers(codec, settings, reference)) {
+      continue;
+    }
+
+    /* The DPC-11 always writes MYSTERY_DB before changing the deadband or
+    smartSense. I'm not sure why, but we do the same to be safe. */
+    if ((codec.flags & HD_CODEC_MYSTERY_DB) && !wroteMysteryDB) {
+      regsOut[n] = HD_REG_MYSTERY_DB;
+      valsOut[n++] = HD_MYSTERY_DB_CONST;
+      wroteMysteryDB = true;
+    }
+
+    uint8_t count = hitecdEncodeSetting(codec, settings, ssConsts,
+      &regsOut[n], &valsOut[n]);
+    if (count == 0) {
+      continue;
+    }
+    n += count;
+
+    /* Likewise, it writes MYSTERY_OP1/2 whenever it changes
+    overloadProtection. */
+    if (codec.flags & HD_CODEC_MYSTERY_OP) {
+      regsOut[n] = HD_REG_MYSTERY_OP1;
+      valsOut[n++] = HD_MYSTERY_OP1_CONST;
+      regsOut[n] = HD_REG_MYSTERY_OP2;
+      valsOut[n++] = HD_MYSTERY_OP2_CONST;
+    }
+  }
+  return n;
+}
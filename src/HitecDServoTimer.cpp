@@ -0,0 +1,276 @@
+#include "HitecDServo.h"
+
+#include "HitecDServoInternal.h"
+#include "HitecDServoTimer.h"
+
+#ifdef HD_TIMER_AVAILABLE
+
+#if defined(TCCR2A)
+#define HD_TIMER_VECT TIMER2_COMPA_vect
+#else
+#define HD_TIMER_VECT TIMER1_COMPA_vect
+#endif
+
+/* Timer ticks per bit at 115200 baud, rounded to nearest */
+#define HD_TIMER_TICKS_PER_BIT ((F_CPU + 57600) / 115200)
+
+/* Approximate number of clock cycles from a start-bit edge until
+hitecdTimerRxEdge() restarts the timer (pin-change interrupt entry and
+prologue, plus the call). We start the timer this much further along so that
+samples land in the middle of each bit. */
+#define HD_TIMER_RX_LATENCY_CYCLES 48
+
+static bool rxMode;
+
+static volatile uint8_t *txOutputRegister;
+static uint8_t txBitMask;
+
+/* Line level for each bit of the frame (start, data, and stop bits), packed
+LSB-first. The frame is encoded into this buffer before transmission starts, so
+the interrupt handler doesn't have to do any encoding. (The extra byte is
+because the handler looks one bit ahead.) */
+static uint8_t txLevels[(HD_TIMER_MAX_FRAME_LEN * 10) / 8 + 1];
+static uint8_t txBitsLeft;
+static uint8_t *txLevelPtr;
+static uint8_t txLevelMask;
+static bool txNextLevel;
+
+static volatile unsigned long txEndMicros;
+
+static volatile uint8_t *rxInputRegister;
+static uint8_t rxBitMask;
+static volatile uint8_t *rxPCMSK;
+static uint8_t rxPCMSKBit, rxPCICRBit;
+static uint8_t rxLen, rxBit, rxByte;
+
+static void startTimer(uint8_t initialCount) {
+#if defined(TCCR2A)
+  TCCR2A = _BV(WGM21); /* CTC mode */
+  TCCR2B = 0;
+  TCNT2 = initialCount;
+  OCR2A = HD_TIMER_TICKS_PER_BIT - 1;
+  TIFR2 = _BV(OCF2A);
+  TIMSK2 |= _BV(OCIE2A);
+  TCCR2B = _BV(CS20); /* No prescaling */
+#else
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = initialCount;
+  OCR1A = HD_TIMER_TICKS_PER_BIT - 1;
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+  TCCR1B = _BV(WGM12) | _BV(CS10); /* CTC mode, no prescaling */
+#endif
+}
+
+static void stopTimer() {
+#if defined(TCCR2A)
+  TIMSK2 &= ~_BV(OCIE2A);
+  TCCR2B = 0;
+#else
+  TIMSK1 &= ~_BV(OCIE1A);
+  TCCR1B = 0;
+#endif
+}
+
+static void armPinChange() {
+  PCIFR = _BV(rxPCICRBit);
+  *rxPCMSK |= rxPCMSKBit;
+}
+
+static inline void receiveBit() {
+  /* Sample the line first thing, so that the time from the timer compare to
+  the sample is the same for every bit. */
+  bool level = (*rxInputRegister & rxBitMask) != 0;
+
+  if (rxBit == 0) {
+    /* Middle of the start bit. Polarity is inverted, so it should be HIGH; if
+    not, the edge was just a glitch. */
+    if (!level) {
+      stopTimer();
+      TIMSK0 |= _BV(TOIE0);
+      armPinChange();
+      return;
+    }
+  } else {
+    rxByte >>= 1;
+    if (!level) {
+      rxByte |= 0x80;
+    }
+
+    if (rxBit == 8) {
+      /* That was the last data bit. We don't sample the stop bit, because the
+      next start bit can follow it immediately and we have to be ready to
+      catch its edge. (The checksum still catches corrupt responses.) */
+      stopTimer();
+      TIMSK0 |= _BV(TOIE0);
+      hitecdTimerRxBuffer[hitecdTimerRxCount] = rxByte;
+      hitecdTimerRxCount = hitecdTimerRxCount + 1;
+      if (hitecdTimerRxCount < rxLen) {
+        armPinChange();
+      } else {
+        rxMode = false;
+        hitecdTimerBusy = false;
+      }
+      return;
+    }
+  }
+
+  ++rxBit;
+}
+
+static inline void transmitBit() {
+  if (txBitsLeft == 0) {
+    /* The stop bit of the last byte has now lasted a full bit period. */
+    stopTimer();
+    TIMSK0 |= _BV(TOIE0);
+    txEndMicros = micros();
+    hitecdTimerBusy = false;
+    return;
+  }
+
+  /* Output the level first thing, so that the time from the timer compare to
+  the edge is the same for every bit. */
+  if (txNextLevel) {
+    *txOutputRegister |= txBitMask;
+  } else {
+    *txOutputRegister &= ~txBitMask;
+  }
+
+  --txBitsLeft;
+  txLevelMask <<= 1;
+  if (txLevelMask == 0) {
+    txLevelMask = 1;
+    ++txLevelPtr;
+  }
+  txNextLevel = (*txLevelPtr & txLevelMask) != 0;
+}
+
+ISR(HD_TIMER_VECT) {
+  if (rxMode) {
+    receiveBit();
+  } else {
+    transmitBit();
+  }
+}
+
+void hitecdTimerWriteFrame(
+  volatile uint8_t *outputRegister,
+  uint8_t bitMask,
+  const uint8_t *frame,
+  uint8_t len
+) {
+  /* Wait for the previous frame to finish, then leave the same 1ms gap that
+  the bit-banged writeRawRegister() leaves between frames. */
+  while (hitecdTimerBusy) { }
+  while (micros() - txEndMicros < 1000) { }
+
+  /* Encode the frame. Polarity is inverted, so the start bit is HIGH, a 1 data
+  bit is LOW, and the stop bit is LOW. */
+  memset(txLevels, 0, sizeof(txLevels));
+  uint8_t bit = 0;
+  for (uint8_t i = 0; i < len; ++i) {
+    txLevels[bit >> 3] |= 1 << (bit & 7);
+    ++bit;
+    for (uint8_t m = 0x01; m != 0x00; m <<= 1) {
+      if (!(frame[i] & m)) {
+        txLevels[bit >> 3] |= 1 << (bit & 7);
+      }
+      ++bit;
+    }
+    ++bit;
+  }
+
+  txOutputRegister = outputRegister;
+  txBitMask = bitMask;
+  txBitsLeft = bit;
+  txLevelPtr = txLevels;
+  txLevelMask = 1;
+  txNextLevel = true;
+  rxMode = false;
+  hitecdTimerBusy = true;
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  /* The Timer0 overflow interrupt (which drives millis() and micros()) is the
+  most common source of interrupt latency, so hold it off until the frame is
+  done. A frame is shorter than one Timer0 overflow period, so the pending
+  overflow will be serviced afterwards and no time is lost. */
+  TIMSK0 &= ~_BV(TOIE0);
+
+  /* The first edge is output by the interrupt handler too, one bit period from
+  now, so that every edge has the same latency. */
+  startTimer(0);
+
+  SREG = oldSREG;
+}
+
+void hitecdTimerRxEdge() {
+  /* Only rising edges (start bits, because of the inverted polarity) are
+  interesting. Falling edges at the end of the previous byte are ignored. */
+  if (!(*rxInputRegister & rxBitMask)) {
+    return;
+  }
+
+  /* Hold off Timer0 while sampling the byte; see hitecdTimerWriteFrame(). */
+  *rxPCMSK &= ~rxPCMSKBit;
+  TIMSK0 &= ~_BV(TOIE0);
+
+  /* The first timer interrupt will land in the middle of the start bit, and
+  each subsequent one in the middle of the next data bit. */
+  rxBit = 0;
+  startTimer(HD_TIMER_TICKS_PER_BIT / 2 + HD_TIMER_RX_LATENCY_CYCLES);
+}
+
+void hitecdTimerStartReceive(uint8_t pin, uint8_t len) {
+  while (hitecdTimerBusy) { }
+
+  uint8_t port = digitalPinToPort(pin);
+  rxInputRegister = portInputRegister(port);
+  rxBitMask = digitalPinToBitMask(pin);
+  rxPCMSK = digitalPinToPCMSK(pin);
+  rxPCMSKBit = _BV(digitalPinToPCMSKbit(pin));
+  rxPCICRBit = digitalPinToPCICRbit(pin);
+  rxLen = len;
+  hitecdTimerRxCount = 0;
+  rxMode = true;
+  hitecdTimerBusy = true;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  *digitalPinToPCICR(pin) |= _BV(rxPCICRBit);
+  armPinChange();
+  SREG = oldSREG;
+}
+
+void hitecdTimerStopReceive() {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (rxMode) {
+    *rxPCMSK &= ~rxPCMSKBit;
+    stopTimer();
+    TIMSK0 |= _BV(TOIE0);
+    rxMode = false;
+    hitecdTimerBusy = false;
+  }
+  SREG = oldSREG;
+}
+
+int HitecDServo::useTimerTransmit(bool enable) {
+  while (hitecdTimerBusy) { }
+  timerWriteFrame = enable ? hitecdTimerWriteFrame : NULL;
+  return HITECD_OK;
+}
+
+#else /* HD_TIMER_AVAILABLE */
+
+int HitecDServo::useTimerTransmit(bool enable) {
+  if (enable) {
+    return HITECD_ERR_NO_TIMER;
+  }
+  timerWriteFrame = NULL;
+  return HITECD_OK;
+}
+
+#endif /* HD_TIMER_AVAILABLE */
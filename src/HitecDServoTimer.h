@@ -0,0 +1,70 @@
+#ifndef HitecDServoTimer_h
+#define HitecDServoTimer_h
+
+/* Interrupt-driven bit engine, used by HitecDServo::useTimerTransmit() and
+HitecDServo::useTimerReceive(). This header is internal to the library.
+
+The engine lives in its own translation units, and HitecDServo only reaches it
+through pointers that useTimerTransmit() and useTimerReceive() fill in.
+Combined with `dot_a_linkage=true` in library.properties, this means the
+engine's interrupt handlers are only linked into sketches that actually use
+them, so they don't collide with other users of the same vectors (e.g. tone()
+or SoftwareSerial). */
+
+#include <Arduino.h>
+
+/* The engine needs a timer that can interrupt once per bit. Timer2 is the
+natural choice on the ATmega328P, because it's only otherwise used by tone().
+The ATmega32U4 doesn't have a Timer2, so we use Timer1 instead (which conflicts
+with the standard Servo library).
+
+The interrupt handler takes somewhere around 60-80 clock cycles including the
+prologue and epilogue. At 115200 baud, a bit lasts 139 cycles at 16MHz but only
+69 cycles at 8MHz, which isn't enough. */
+#if defined(ARDUINO_ARCH_AVR) && \
+    (defined(TCCR2A) || defined(TCCR1A)) && \
+    F_CPU >= 16000000L
+#define HD_TIMER_AVAILABLE
+#endif
+
+/* Longest frame the engine can send or receive. (A register write and the
+servo's response are both 7 bytes.) */
+#define HD_TIMER_MAX_FRAME_LEN 7
+
+/* The following are defined in HitecDServo.cpp rather than in the engine
+itself, so that checking them doesn't pull in the engine. */
+
+/* True while the engine is sending or receiving a frame. */
+extern volatile bool hitecdTimerBusy;
+
+/* Bytes received so far by the receiver, and how many of them are valid. */
+extern uint8_t hitecdTimerRxBuffer[HD_TIMER_MAX_FRAME_LEN];
+extern volatile uint8_t hitecdTimerRxCount;
+
+/* Starts sending the given frame on the given pin, one bit per timer
+interrupt, and returns without waiting for it to finish. If a previous frame is
+still being sent, waits for it to finish first. */
+void hitecdTimerWriteFrame(
+  volatile uint8_t *outputRegister,
+  uint8_t bitMask,
+  const uint8_t *frame,
+  uint8_t len);
+
+/* Receiver operations, filled in by useTimerReceive(). start() arms a
+pin-change interrupt for the start bit of each byte, and the timer interrupt
+samples the rest of the byte; received bytes appear in hitecdTimerRxBuffer.
+stop() disarms the receiver early (e.g. on timeout). */
+struct HitecDTimerReceiver {
+  void (*start)(uint8_t pin, uint8_t len);
+  void (*stop)();
+};
+
+/* Called by the pin-change interrupt handler when the line changes. Defined in
+HitecDServoTimer.cpp; the pin-change handlers themselves are in
+HitecDServoTimerRx.cpp, so that they're only linked in if the receiver is
+used. */
+void hitecdTimerRxEdge();
+void hitecdTimerStartReceive(uint8_t pin, uint8_t len);
+void hitecdTimerStopReceive();
+
+#endif /* HitecDServoTimer_h */
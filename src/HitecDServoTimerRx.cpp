@@ -0,0 +1,71 @@
+#include "HitecDServo.h"
+
+#include "HitecDServoInternal.h"
+#include "HitecDServoTimer.h"
+
+#ifdef HD_TIMER_AVAILABLE
+
+/* The receiver uses pin-change interrupts to catch the start bit of each
+byte. These handlers are in their own translation unit (separate from the
+timer handler) so that sketches which only use useTimerTransmit() can still use
+SoftwareSerial, which also defines them. */
+
+#ifdef PCINT0_vect
+ISR(PCINT0_vect) {
+  hitecdTimerRxEdge();
+}
+#endif
+
+#ifdef PCINT1_vect
+ISR(PCINT1_vect) {
+  hitecdTimerRxEdge();
+}
+#endif
+
+#ifdef PCINT2_vect
+ISR(PCINT2_vect) {
+  hitecdTimerRxEdge();
+}
+#endif
+
+#ifdef PCINT3_vect
+ISR(PCINT3_vect) {
+  hitecdTimerRxEdge();
+}
+#endif
+
+static const HitecDTimerReceiver timerReceiverOps = {
+  hitecdTimerStartReceive,
+  hitecdTimerStopReceive
+};
+
+int HitecDServo::useTimerReceive(bool enable) {
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (!enable) {
+    timerReceiver = NULL;
+    return HITECD_OK;
+  }
+  if (digitalPinToPCICR(pin) == NULL) {
+    /* This pin doesn't support pin-change interrupts. */
+    return HITECD_ERR_NO_TIMER;
+  }
+  timerReceiver = &timerReceiverOps;
+  return HITECD_OK;
+}
+
+#else /* HD_TIMER_AVAILABLE */
+
+int HitecDServo::useTimerReceive(bool enable) {
+  if (!attached()) {
+    return HITECD_ERR_NOT_ATTACHED;
+  }
+  if (enable) {
+    return HITECD_ERR_NO_TIMER;
+  }
+  timerReceiver = NULL;
+  return HITECD_OK;
+}
+
+#endif /* HD_TIMER_AVAILABLE */
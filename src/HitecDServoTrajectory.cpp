@@ -0,0 +1,189 @@
+#include "HitecDServoTrajectory.h"
+
+#define HD_TRAJ_DEFAULT_RATE 200
+
+HitecDServoTrajectory::HitecDServoTrajectory() :
+  ticking(false),
+  maxVel(0),
+  accel(0),
+  smoothing(1),
+  smoothingShift(0)
+{
+  setRate(HD_TRAJ_DEFAULT_RATE);
+  reset(4 * 1500);
+}
+
+void HitecDServoTrajectory::setRate(uint16_t _ticksPerSecond) {
+  ticksPerSecond = _ticksPerSecond;
+  periodMicros = 1000000UL / ticksPerSecond;
+  ticking = false;
+}
+
+void HitecDServoTrajectory::setLimits(
+  uint32_t maxVelocity,
+  uint32_t maxAcceleration,
+  uint32_t maxJerk
+) {
+  /* Convert to 16.16 fixed-point per tick. Dividing in two steps keeps the
+  intermediate values within 32 bits. */
+  maxVel = ((maxVelocity << 8) / ticksPerSecond) << 8;
+  accel = ((((maxAcceleration << 8) / ticksPerSecond) << 8) / ticksPerSecond);
+  if (accel < 1) {
+    accel = 1;
+  }
+
+  /* Averaging over N ticks turns each step in acceleration into a ramp lasting
+  N ticks, so the jerk is maxAcceleration / (N / ticksPerSecond). Round N up, so
+  the jerk doesn't exceed maxJerk (unless N would have to be more than
+  HITECD_TRAJECTORY_MAX_SMOOTHING). */
+  uint32_t ticks = 1;
+  if (maxJerk != 0) {
+    ticks = (maxAcceleration * ticksPerSecond + maxJerk - 1) / maxJerk;
+  }
+  uint8_t shift = 0;
+  while (shift < 4 && (1UL << shift) < ticks) {
+    ++shift;
+  }
+
+  if (shift != smoothingShift) {
+    /* Start the new average from the current position, so the output doesn't
+    jump, and carry on with the move. */
+    smoothingShift = shift;
+    smoothing = 1 << shift;
+    fillHistory(output);
+  }
+}
+
+void HitecDServoTrajectory::fillHistory(int16_t quarterMicros) {
+  for (uint8_t i = 0; i < smoothing; ++i) {
+    history[i] = quarterMicros;
+  }
+  historySum = (int32_t)quarterMicros << smoothingShift;
+  historyIndex = 0;
+  output = quarterMicros;
+}
+
+void HitecDServoTrajectory::reset(int16_t quarterMicros) {
+  pos = goal = (int32_t)quarterMicros << 16;
+  vel = 0;
+  fillHistory(quarterMicros);
+  lastWritten = -1;
+}
+
+void HitecDServoTrajectory::moveTo(int16_t goalQuarterMicros) {
+  goal = (int32_t)goalQuarterMicros << 16;
+}
+
+bool HitecDServoTrajectory::done() {
+  return pos == goal && vel == 0 && output == (int16_t)(goal >> 16);
+}
+
+int16_t HitecDServoTrajectory::position() {
+  return output;
+}
+
+/* Distance covered while braking from `speed` to a stop, at `accel` per tick:
+(speed - accel) + (speed - 2*accel) + ..., for as long as that's positive.
+Saturates rather than overflowing. */
+static uint32_t brakingDistance(uint32_t speed, uint32_t accel) {
+  uint32_t n = speed / accel;
+  if (n == 0) {
+    return 0;
+  }
+  /* n * speed - accel * n * (n + 1) / 2, rearranged to keep it within 32 bits;
+  accel * (n + 1) <= speed + accel. */
+  uint32_t perTick = speed - accel * (n + 1) / 2;
+  if (perTick > 0xFFFFFFFFUL / n) {
+    return 0xFFFFFFFFUL;
+  }
+  return n * perTick;
+}
+
+int16_t HitecDServoTrajectory::step() {
+  int32_t dist = goal - pos;
+
+  if (dist != 0 || vel != 0) {
+    /* Work in terms of the distance to the goal and the speed towards it. */
+    int8_t dir = dist > 0 || (dist == 0 && vel < 0) ? 1 : -1;
+    uint32_t absDist = dist < 0 ? -dist : dist;
+    int32_t towards = dir > 0 ? vel : -vel;
+    int32_t speed;
+
+    if (towards < 0) {
+      /* Moving away from the goal; slow down. */
+      speed = towards + accel;
+      if (speed > 0) {
+        speed = 0;
+      }
+    } else if (absDist <= (uint32_t)accel && towards <= accel) {
+      /* Close enough to stop at the goal this tick. */
+      speed = absDist;
+    } else {
+      /* Go as fast as possible (within the limits) while still being able to
+      stop at the goal after this tick's move. If even braking as hard as
+      possible isn't enough (because the goal moved), brake anyway. */
+      int32_t faster = towards + accel;
+      int32_t same = towards;
+      int32_t slower = towards > accel ? towards - accel : 0;
+      int32_t limit = maxVel > slower ? maxVel : slower;
+      if (faster > limit) {
+        faster = limit;
+      }
+      if (same > limit) {
+        same = limit;
+      }
+
+      speed = slower;
+      if ((uint32_t)faster <= absDist &&
+          absDist - faster >= brakingDistance(faster, accel)) {
+        speed = faster;
+      } else if ((uint32_t)same <= absDist &&
+          absDist - same >= brakingDistance(same, accel)) {
+        speed = same;
+      }
+    }
+
+    /* Never pass the goal. */
+    if (speed >= 0 && (uint32_t)speed >= absDist) {
+      pos = goal;
+      vel = 0;
+    } else {
+      vel = dir > 0 ? speed : -speed;
+      pos += vel;
+    }
+  }
+
+  /* Round to the nearest quarter-microsecond, and average. */
+  int16_t rounded = (pos + 0x8000) >> 16;
+  historySum += rounded - history[historyIndex];
+  history[historyIndex] = rounded;
+  historyIndex = (historyIndex + 1) & (smoothing - 1);
+  output = historySum >> smoothingShift;
+  return output;
+}
+
+bool HitecDServoTrajectory::update(HitecDServo *servo) {
+  unsigned long now = micros();
+  if (!ticking) {
+    ticking = true;
+    nextTickMicros = now;
+  }
+  if ((long)(now - nextTickMicros) < 0) {
+    return false;
+  }
+
+  /* If we fell more than a tick behind, skip the missed ticks rather than
+  trying to catch up. */
+  nextTickMicros += periodMicros;
+  if ((long)(now - nextTickMicros) >= 0) {
+    nextTickMicros = now + periodMicros;
+  }
+
+  int16_t quarterMicros = step();
+  if (quarterMicros == lastWritten) {
+    return false;
+  }
+  servo->writeTargetQuarterMicros(quarterMicros);
+  lastWritten = quarterMicros;
+  return true;
+}
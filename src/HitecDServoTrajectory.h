@@ -0,0 +1,100 @@
+#ifndef HitecDServoTrajectory_h
+#define HitecDServoTrajectory_h
+
+#include "HitecDServo.h"
+
+/* The most ticks that HitecDServoTrajectory averages over to limit jerk */
+#define HITECD_TRAJECTORY_MAX_SMOOTHING 16
+
+/* HitecDServoTrajectory moves a servo smoothly, by writing a stream of TARGET
+values that follow a velocity- and acceleration-limited path, instead of
+writing the goal once and letting the servo get there at its programmed speed.
+This doesn't need the servo's speed setting to be changed (which would require
+a reboot).
+
+The path is a trapezoid: accelerate at the maximum acceleration, cruise at the
+maximum velocity, then decelerate so as to stop at the goal. If a maximum jerk
+is set, the acceleration is also ramped up and down (an "S-curve"); this is done
+by averaging the path over up to HITECD_TRAJECTORY_MAX_SMOOTHING ticks, so the
+move takes that many ticks longer. Positions are in quarter-microseconds, like
+writeTargetQuarterMicros(), and the limits are in quarter-microseconds per
+second (per second, per second). All the arithmetic is fixed-point.
+
+Example usage:
+    HitecDServo servo;
+    HitecDServoTrajectory trajectory;
+    ...
+    trajectory.setRate(250);
+    trajectory.setLimits(2000, 8000, 100000);
+    trajectory.reset(servo.readCurrentQuarterMicros());
+    trajectory.moveTo(4 * 2000);
+    while (!trajectory.done()) {
+      trajectory.update(&servo);
+      (do something else)
+    }
+
+update() keeps its own schedule based on micros(), so just call it as often as
+possible. Alternatively, call step() at the tick rate (e.g. from a timer
+interrupt) and write the positions it returns yourself. */
+class HitecDServoTrajectory {
+public:
+  HitecDServoTrajectory();
+
+  /* Sets how many TARGET values are written per second; the default is 200.
+  Each write takes about 1.6ms (0.6ms with HitecDServo::useTimerTransmit()), so
+  rates above about 500 don't leave time for much else. Call this before
+  setLimits(). */
+  void setRate(uint16_t ticksPerSecond);
+
+  /* Sets the maximum velocity, acceleration, and (optionally) jerk. If
+  `maxJerk` is 0, the acceleration changes instantly. This can be called in the
+  middle of a move; the move carries on with the new limits. */
+  void setLimits(uint32_t maxVelocity, uint32_t maxAcceleration,
+    uint32_t maxJerk = 0);
+
+  /* Stops immediately at the given position, e.g. the servo's current
+  position. Call this before the first moveTo(). */
+  void reset(int16_t quarterMicros);
+
+  /* Starts moving towards the given position. This can be called in the middle
+  of a move; the trajectory changes course smoothly. */
+  void moveTo(int16_t goalQuarterMicros);
+
+  /* Returns whether the trajectory has reached the goal. */
+  bool done();
+
+  /* Returns the most recent position returned by step(). */
+  int16_t position();
+
+  /* Advances the trajectory by one tick, and returns the new position. */
+  int16_t step();
+
+  /* If it's time for the next tick, advances the trajectory and writes the new
+  position to the servo (unless it's the same as last time). Returns whether it
+  wrote to the servo. */
+  bool update(HitecDServo *servo);
+
+private:
+  void fillHistory(int16_t quarterMicros);
+
+  uint16_t ticksPerSecond;
+  unsigned long periodMicros, nextTickMicros;
+  bool ticking;
+
+  /* Per-tick limits, in 16.16 fixed-point quarter-microseconds per tick (per
+  tick) */
+  int32_t maxVel, accel;
+
+  /* The unsmoothed trapezoid, in 16.16 fixed-point */
+  int32_t pos, vel, goal;
+
+  /* The last `smoothing` (a power of 2) positions of the trapezoid, and their
+  sum. The smoothed position is their average. */
+  uint8_t smoothing, smoothingShift, historyIndex;
+  int16_t history[HITECD_TRAJECTORY_MAX_SMOOTHING];
+  int32_t historySum;
+
+  int16_t output, lastWritten;
+};
+
+#endif /* HitecDServoTrajectory_h */